@@ -15,20 +15,47 @@
 #include "SDL_opengl.h"
 #include "SDL_ttf.h"
 
+#include "sosg_source.h"
 #include "sosg_image.h"
 #include "sosg_video.h"
 #include "sosg_predict.h"
 #include "sosg_tracker.h"
+#include "sosg_warp.h"
+#include "sosg_stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include <unistd.h> // TODO: use the windows equivalent when on windows
 #include <math.h>
+#include <time.h>
 
 #define TICK_INTERVAL 33
+// Rotation speeds are in radians per TICK_INTERVAL of wall time
 #define ROTATION_INTERVAL M_PI/(120.0*(1000.0/TICK_INTERVAL))
 #define ROTATION_CONSTANT (float)30.5*ROTATION_INTERVAL
 #define CLOSE_ENOUGH(a, b) (fabs(a - b) < ROTATION_INTERVAL/2)
+#define PBO_COUNT 3
+#define STATS_INTERVAL 300
+#define IMAGE_CACHE_MB 512
+#define FRAME_BINS 50
+#define GPU_QUERIES 4
+#define HUD_INTERVAL 30
+#define HUD_FONT_SIZE 18
+#define STATS_DUMP "sosg-stats.csv"
+#define BENCH_SECONDS 10
+#define MAX_LAYERS 4
+// Layers after the first are on the texture units after the overlay's
+#define LAYER_UNIT(i) ((i) ? 2 + (i) : 0)
+// and the frames they are fading from come after those
+#define PREV_UNIT(i) (2 + MAX_LAYERS + (i))
+// Longest a frame takes to fade into the next when interpolating
+#define FADE_MAX 2000.0
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
 
 enum sosg_mode {
     SOSG_IMAGES,
@@ -36,44 +63,206 @@ enum sosg_mode {
     SOSG_PREDICT
 };
 
+// The source for each mode
+static sosg_source_p sources[] = {
+    &sosg_image_source,
+    &sosg_video_source,
+    &sosg_predict_source
+};
+
+enum sosg_blend {
+    BLEND_NORMAL,
+    BLEND_ADD,
+    BLEND_MULTIPLY,
+    BLEND_NUM_MODES
+};
+
+static const char *blend_names[BLEND_NUM_MODES] = {"normal", "add", "multiply"};
+
+typedef struct sosg_texture_struct {
+    GLuint id;
+    int size[2];
+    int bpp;
+} sosg_texture_t, *sosg_texture_p;
+
+// A source and the textures it streams into.  The first layer is the base,
+// and the shader composites the rest over it in order.
+typedef struct sosg_layer_struct {
+    int mode;
+    char *path;
+    float opacity;
+    int blend;
+    float fps;
+    int interval;   // Milliseconds between frames, or 0 to take every frame
+    Uint32 last;
+    sosg_source_p source;
+    void *source_data;
+    // The media thread owns the frame while ready is 0, and the render loop
+    // while it is 1.  holding is only used by the media thread.
+    int ready;
+    int holding;
+    sosg_frame_t frame;
+    float time;
+    int seeked;     // Only used by the media thread
+    int cut;        // Set with the first frame after a seek
+    int shown;
+    int texres[2];
+    // When fading, frames alternate between the two textures so the last
+    // one stays up to fade from
+    sosg_texture_t textures[2];
+    int current;
+    GLuint bound[2];    // The current and previous frames as drawn
+    double arrived;
+    double fade_start;
+    double fade_length;
+    float fade;
+    GLint ltexres;
+    GLint lmix;
+    GLint lfade;
+} sosg_layer_t, *sosg_layer_p;
+
 typedef struct sosg_struct {
     int w;
     int h;
     int fullscreen;
-    int texres[2];
+    int warp_lut;
+    int yuv;
+    int scrub;
+    int vsync;
+    int stats;
+    int bench;
+    float fps;
+    int playback;
+    int crossfade;
+    int interpolate;
+    int fade;
+    int cache_mb;
+    int reduce;
+    sosg_limits_t limits;
     float radius;
     float height;
     float center[2];
     float rotation;
     float drotation;
     Uint32 time;
+    double frame_time;
+    double elapsed;
+    int frame_hist[FRAME_BINS];
     int index;
     int mode;
-    // TODO: use function pointers for different sources
-    union {
-        sosg_image_p images;
-        sosg_video_p video;
-        sosg_predict_p predict;
-    } source;
+    sosg_layer_t layers[MAX_LAYERS];
+    int num_layers;
     sosg_tracker_p tracker;
+    // Frames are prepared on the media thread and handed to the render loop
+    // one at a time for each layer
+    SDL_Thread *media_thread;
+    SDL_mutex *media_lock;
+    SDL_cond *media_cond;
+    sosg_wake_t media_wake;
+    int media_running;
+    int media_index;
+    float media_position;   // Scrub position, or negative if not scrubbing
     SDL_Surface *screen;
     SDL_Surface *text;
-    GLuint texture;
+    GLuint overlay;
+    int overlay_size[2];
+    float overlay_pos[2];
+    GLuint pbo[PBO_COUNT];
+    int pbo_index;
+    int uploads;
+    double upload_time;
+    double upload_max;
+    GLuint warp;
+    sosg_stats_p perf;
+    char *dump_path;
+    GLuint gpu_queries[GPU_QUERIES];
+    int gpu_pending[GPU_QUERIES];
+    int gpu_query;
+    int gpu_timer;
+    int hud;
+    int hud_frames;
+    int hud_size[2];
+    TTF_Font *hud_font;
+    GLuint hud_texture;
     GLuint program;
     GLuint vertex;
     GLuint fragment;
     GLuint lrotation;
-    GLuint ltexres;
 } sosg_t, *sosg_p;
 
-static void load_texture(sosg_p data, SDL_Surface *surface)
+static volatile sig_atomic_t dump_requested = 0;
+
+static void request_dump(int sig)
+{
+    dump_requested = 1;
+}
+
+static double get_time(void)
 {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static void load_texture(sosg_p data, sosg_texture_p texture, sosg_frame_p frame)
+{
+    double start = get_time();
+    int size = frame->pitch*frame->h;
+    int bpp = frame->format == SOSG_FRAME_YUV ? 1 : 4;
+    GLenum format = bpp == 1 ? GL_LUMINANCE : GL_BGRA;
+    void *pixels;
+
     // Bind the texture object
-    glBindTexture(GL_TEXTURE_2D, data->texture);
+    glBindTexture(GL_TEXTURE_2D, texture->id);
     
-    // Edit the texture object's image data using the information SDL_Surface gives us
-    glTexImage2D(GL_TEXTURE_2D, 0, 4, surface->w, surface->h, 0, 
-                  GL_BGRA, GL_UNSIGNED_BYTE, surface->pixels);
+    // Only reallocate the texture storage when the source resolution changes
+    if (frame->w != texture->size[0] || frame->h != texture->size[1] ||
+        bpp != texture->bpp) {
+        glTexImage2D(GL_TEXTURE_2D, 0, bpp == 1 ? GL_LUMINANCE8 : GL_RGBA8,
+                      frame->w, frame->h, 0, format, GL_UNSIGNED_BYTE, NULL);
+        texture->size[0] = frame->w;
+        texture->size[1] = frame->h;
+        texture->bpp = bpp;
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, frame->pitch/bpp);
+    
+    // Rotate through the ring of pixel buffers so we never write into one
+    // the GPU may still be reading from for the previous frame
+    data->pbo_index = (data->pbo_index + 1) % PBO_COUNT;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, data->pbo[data->pbo_index]);
+    // Orphan the old storage so mapping does not wait on a pending transfer
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (pixels) {
+        memcpy(pixels, frame->pixels, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        // With a buffer bound, the last argument is an offset into it and
+        // the transfer to the texture happens asynchronously
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame->w, frame->h,
+                        format, GL_UNSIGNED_BYTE, (GLvoid *)0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        // Fall back to a synchronous upload if the buffer can't be mapped
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame->w, frame->h,
+                        format, GL_UNSIGNED_BYTE, frame->pixels);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    sosg_stats_add(data->perf, STATS_UPLOADED, 1);
+    sosg_stats_add(data->perf, STATS_BYTES, size);
+    
+    double elapsed = get_time() - start;
+    data->upload_time += elapsed;
+    if (elapsed > data->upload_max) data->upload_max = elapsed;
+    if (++data->uploads == STATS_INTERVAL) {
+        if (data->stats) {
+            printf("Upload: %.2f ms average, %.2f ms max over %d frames\n",
+                data->upload_time/data->uploads, data->upload_max, data->uploads);
+        }
+        data->uploads = 0;
+        data->upload_time = 0.0;
+        data->upload_max = 0.0;
+    }
 }
 
 static char *load_file(char *filename)
@@ -99,9 +288,122 @@ static char *load_file(char *filename)
 	return buf;
 }
 
+// Upload the warp as a lookup table.  Returns 1 if it can't be used.
+static int load_warp(sosg_p data)
+{
+    GLint bits = 0;
+    Uint16 *lut = sosg_warp_lut(data->w, data->h, data->radius, data->height,
+        data->center);
+    if (!lut) return 1;
+    
+    if (!data->warp) glGenTextures(1, &data->warp);
+    
+    // The table is one texel per screen pixel, so never filter it
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, data->warp);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, data->w, data->h, 0,
+        GL_RGBA, GL_UNSIGNED_SHORT, lut);
+    // GL_RGBA16 is only a request, and at 8 bits the coordinates would step
+    // visibly across the globe
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_RED_SIZE, &bits);
+    glActiveTexture(GL_TEXTURE0);
+    
+    free(lut);
+    if (bits < 16) {
+        fprintf(stderr, "Warning: Warp table stored at %d bits, using the analytic warp\n", bits);
+        return 1;
+    }
+    return 0;
+}
+
+// Place the overlay on the source with its left edge at overlay_pos[0] and
+// centered on overlay_pos[1], at the size it would be if drawn into the source
+static void update_overlay(sosg_p data)
+{
+    int *texres = data->layers[0].texres;
+    if (!data->overlay) return;
+
+    GLint loc = glGetUniformLocation(data->program, "overlay_rect");
+    glUniform4f(loc, data->overlay_pos[0],
+        data->overlay_pos[1] - 0.5*data->overlay_size[1]/(float)texres[1],
+        (float)texres[0]/data->overlay_size[0],
+        (float)texres[1]/data->overlay_size[1]);
+}
+
+// Set a layer's resolution, and how it mixes into the layers below
+static void update_layer(sosg_p data, int i)
+{
+    sosg_layer_p layer = data->layers + i;
+
+    glUniform2f(layer->ltexres, 1.0/(float)layer->texres[0], 1.0/(float)layer->texres[1]);
+    if (i == 0) {
+        update_overlay(data);
+    } else {
+        // Nothing shows through until the first frame is in, and only
+        // images are known to have a meaningful alpha channel
+        glUniform3f(layer->lmix, layer->shown ? layer->opacity : 0.0,
+            (float)layer->blend, layer->mode == SOSG_IMAGES ? 1.0 : 0.0);
+    }
+}
+
+// Upload the overlay once, for the shader to composite over every frame
+static void load_overlay(sosg_p data)
+{
+    SDL_Surface *text = data->text;
+    if (!text) return;
+
+    glGenTextures(1, &data->overlay);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, data->overlay);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, text->pitch/4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, text->w, text->h, 0, GL_BGRA,
+                 GL_UNSIGNED_BYTE, text->pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glActiveTexture(GL_TEXTURE0);
+
+    data->overlay_size[0] = text->w;
+    data->overlay_size[1] = text->h;
+    // On the left edge, centered vertically
+    data->overlay_pos[0] = 0.0;
+    data->overlay_pos[1] = 0.5;
+    SDL_FreeSurface(text);
+    data->text = NULL;
+}
+
+static void unload_shaders(sosg_p data)
+{
+    if (data->program) {
+        glUseProgram(0);
+        glDeleteProgram(data->program);
+    }
+    if (data->vertex) glDeleteShader(data->vertex);
+    if (data->fragment) glDeleteShader(data->fragment);
+    data->program = data->vertex = data->fragment = 0;
+}
+
 static int load_shaders(sosg_p data)
 {
     char *vbuf, *fbuf;
+    char layers[32], name[32];
+    int i;
+    // The lookup table has to be precise enough to use
+    if (data->warp_lut && load_warp(data)) data->warp_lut = 0;
+    // The fragment shader picks analytic or lookup table warping, the
+    // source format and the number of layers at compile time
+    snprintf(layers, sizeof(layers), "#define LAYERS %d\n", data->num_layers - 1);
+    const GLchar *fsrc[6] = {data->warp_lut ? "#define WARP_LUT\n" : "",
+                             data->yuv ? "#define YUV\n" : "",
+                             data->overlay ? "#define OVERLAY\n" : "",
+                             data->fade ? "#define FADE\n" : "",
+                             layers, NULL};
     
     vbuf = load_file("sosg.vert");
     if (vbuf) {
@@ -118,7 +420,8 @@ static int load_shaders(sosg_p data)
     data->fragment = glCreateShader(GL_FRAGMENT_SHADER);
     
     glShaderSource(data->vertex, 1, (const GLchar **)&vbuf, NULL);
-    glShaderSource(data->fragment, 1, (const GLchar **)&fbuf, NULL);
+    fsrc[5] = fbuf;
+    glShaderSource(data->fragment, 6, fsrc, NULL);
     
     free(vbuf);
     free(fbuf);
@@ -141,9 +444,39 @@ static int load_shaders(sosg_p data)
     glUniform2f(loc, data->center[0]/(float)data->w, data->center[1]/(float)data->h);
     loc = glGetUniformLocation(data->program, "ratio");
     glUniform1f(loc, (float)data->w/(float)data->h);
-    data->ltexres = glGetUniformLocation(data->program, "texres");
-    glUniform2f(data->ltexres, 1.0/(float)data->texres[0], 1.0/(float)data->texres[1]);
     data->lrotation = glGetUniformLocation(data->program, "rotation");
+    // Sources only store the band of latitudes the warp samples
+    loc = glGetUniformLocation(data->program, "band");
+    glUniform2f(loc, data->limits.band[0], 1.0/(data->limits.band[1] - data->limits.band[0]));
+    loc = glGetUniformLocation(data->program, "tex");
+    glUniform1i(loc, 0);
+    loc = glGetUniformLocation(data->program, "warp");
+    glUniform1i(loc, 1);
+    loc = glGetUniformLocation(data->program, "overlay");
+    glUniform1i(loc, 2);
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        if (i == 0) {
+            layer->ltexres = glGetUniformLocation(data->program, "texres");
+        } else {
+            snprintf(name, sizeof(name), "layer%d", i);
+            loc = glGetUniformLocation(data->program, name);
+            glUniform1i(loc, LAYER_UNIT(i));
+            snprintf(name, sizeof(name), "layer_texres[%d]", i - 1);
+            layer->ltexres = glGetUniformLocation(data->program, name);
+            snprintf(name, sizeof(name), "layer_mix[%d]", i - 1);
+            layer->lmix = glGetUniformLocation(data->program, name);
+        }
+        if (data->fade) {
+            snprintf(name, sizeof(name), "prev%d", i);
+            loc = glGetUniformLocation(data->program, name);
+            glUniform1i(loc, PREV_UNIT(i));
+            snprintf(name, sizeof(name), "fade[%d]", i);
+            layer->lfade = glGetUniformLocation(data->program, name);
+            glUniform1f(layer->lfade, layer->fade);
+        }
+        update_layer(data, i);
+    }
     
     return 0;
 }   
@@ -164,6 +497,8 @@ static void setup_overlay(sosg_p data, char *text)
 
 static int setup(sosg_p data)
 {
+    int i, j;
+    
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "Error: Unable to initialize SDL: %s\n", SDL_GetError());
         return 1;
@@ -174,6 +509,7 @@ static int setup(sosg_p data)
     SDL_ShowCursor(SDL_DISABLE);
     
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_SWAP_CONTROL, data->vsync);
 
     int flags = SDL_OPENGL | (data->fullscreen ? SDL_FULLSCREEN : 0);
     data->screen = SDL_SetVideoMode(data->w, data->h, 32, flags);
@@ -183,6 +519,16 @@ static int setup(sosg_p data)
 		return 1;
 	}
 	
+    // Not every driver lets us wait for vertical sync
+    if (data->vsync) {
+        int swap = 0;
+        SDL_GL_GetAttribute(SDL_GL_SWAP_CONTROL, &swap);
+        if (swap != 1) {
+            fprintf(stderr, "Warning: No vsync, pacing frames with a timer\n");
+            data->vsync = 0;
+        }
+    }
+	
     // Set the OpenGL state after creating the context with SDL_SetVideoMode
 	glClearColor(0, 0, 0, 0);
 	glEnable(GL_TEXTURE_2D); // Need this to display a texture
@@ -193,48 +539,107 @@ static int setup(sosg_p data)
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
     
-    // Have OpenGL generate a texture object handle for us
-    glGenTextures(1, &data->texture);
+    // Each layer streams into its own texture, or two when fading
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        for (j = 0; j < (data->fade ? 2 : 1); j++) {
+            glGenTextures(1, &layer->textures[j].id);
+            glBindTexture(GL_TEXTURE_2D, layer->textures[j].id);
+            
+            // Set the texture's stretching properties
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            // Longitude wraps around, but latitude stops at the edge of the band
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        layer->bound[0] = layer->textures[0].id;
+        layer->fade = 1.0;
+    }
     
-    // Bind the texture object
-    glBindTexture(GL_TEXTURE_2D, data->texture);
+    // Frames are streamed into the texture through these
+    glGenBuffers(PBO_COUNT, data->pbo);
     
-    // Set the texture's stretching properties
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    load_overlay(data);
+    
+    data->media_lock = SDL_CreateMutex();
+    data->media_cond = SDL_CreateCond();
+    data->media_wake.lock = data->media_lock;
+    data->media_wake.cond = data->media_cond;
+    
+    if (data->stats) {
+        // Time the draw on the GPU too, where the driver supports it
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        if (extensions && (strstr(extensions, "GL_ARB_timer_query") ||
+                strstr(extensions, "GL_EXT_timer_query"))) {
+            glGenQueries(GPU_QUERIES, data->gpu_queries);
+            data->gpu_timer = 1;
+        }
+        
+        TTF_Init();
+        data->hud_font = TTF_OpenFont("orbitron-black.otf", HUD_FONT_SIZE);
+        if (data->hud_font) {
+            glGenTextures(1, &data->hud_texture);
+            glBindTexture(GL_TEXTURE_2D, data->hud_texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, data->layers[0].textures[0].id);
+        } else {
+            fprintf(stderr, "Warning: No font for the statistics display\n");
+        }
+        
+#ifdef SIGUSR1
+        signal(SIGUSR1, request_dump);
+#endif
+    }
     
     return 0;
 }
 
 static void update_timer(sosg_p data)
 {
-    Uint32 now = SDL_GetTicks();
+    // With vsync, the swap already waited for the display to be ready for
+    // the next frame.  Otherwise, sleep until the next tick.
+    if (!data->vsync) {
+        Uint32 now = SDL_GetTicks();
 
-    if (data->time > now) {
-        SDL_Delay(data->time - now);
+        if (data->time > now) {
+            SDL_Delay(data->time - now);
+        }
+
+        while (data->time <= now) {
+            data->time += TICK_INTERVAL;
+        }
     }
 
-    while (data->time <= now) {
-        data->time += TICK_INTERVAL;
+    // Animate by how long the last frame actually took, and keep a histogram
+    // of frame times in milliseconds to check the pacing
+    double now = get_time();
+    if (data->frame_time > 0.0) {
+        data->elapsed = now - data->frame_time;
+        int bin = (int)data->elapsed;
+        data->frame_hist[bin < FRAME_BINS ? bin : FRAME_BINS - 1]++;
     }
+    data->frame_time = now;
 }
 
+// Sources are only touched from the media thread, so just pass it the index
 static void update_index(sosg_p data)
 {
-    switch (data->mode) {
-        case SOSG_IMAGES:
-            sosg_image_set_index(data->source.images, data->index);
-            // The resolution can change between images, so update the shader
-            sosg_image_get_resolution(data->source.images, data->texres);
-            glUniform2f(data->ltexres, 1.0/(float)data->texres[0], 1.0/(float)data->texres[1]);
-            break;
-        case SOSG_VIDEO:
-            sosg_video_set_index(data->source.video, data->index);
-            // Video resolution is currently fixed, but this may change in the future
-            break;
-        case SOSG_PREDICT:
-            break;
+    SDL_mutexP(data->media_lock);
+    data->media_index = data->index;
+    SDL_CondSignal(data->media_cond);
+    SDL_mutexV(data->media_lock);
+}
+
+// Likewise for the position to scrub to
+static void update_position(sosg_p data, float position)
+{
+    SDL_mutexP(data->media_lock);
+    if (position != data->media_position) {
+        data->media_position = position;
+        SDL_CondSignal(data->media_cond);
     }
+    SDL_mutexV(data->media_lock);
 }
 
 static int handle_events(sosg_p data)
@@ -273,6 +678,16 @@ static int handle_events(sosg_p data)
                     case SDLK_r:
                         data->rotation = M_PI;
                         break;
+                    case SDLK_h:
+                        data->hud = !data->hud;
+                        data->hud_frames = 0;
+                        break;
+                    case SDLK_l:
+                        // Switch warp modes to compare them on the same content
+                        data->warp_lut = !data->warp_lut;
+                        unload_shaders(data);
+                        if (load_shaders(data)) return -1;
+                        break;
                     default:
                         break;
                 }
@@ -302,53 +717,365 @@ static int handle_events(sosg_p data)
     return 0;
 }
 
+static void seek_media(sosg_p data, int index)
+{
+    int i;
+    // Every layer moves through its items together
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        if (layer->source->seek) layer->source->seek(layer->source_data, index);
+        layer->seeked = 1;
+    }
+}
+
+static void scrub_media(sosg_p data, float position)
+{
+    int i;
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        if (layer->source->scrub) layer->source->scrub(layer->source_data, position);
+    }
+}
+
+static void release_media(sosg_layer_p layer)
+{
+    if (layer->holding && layer->source->release_frame)
+        layer->source->release_frame(layer->source_data, &layer->frame);
+    layer->holding = 0;
+}
+
+// Prepare frames for the render loop, so a slow source never holds up the
+// swap.  Frames are handed over as the source's own buffers, and each one is
+// released back to the source once the render loop has uploaded it, before
+// the layer's next is acquired.  Layers with an interval are only asked for
+// a frame that often, so a static base costs nothing after its first.
+static int media_loop(void *arg)
+{
+    sosg_p data = (sosg_p)arg;
+    int i, index = data->media_index;
+    float position = -1.0;
+    int ready[MAX_LAYERS];
+
+    SDL_mutexP(data->media_lock);
+    while (data->media_running) {
+        int waiting = 0;
+        for (i = 0; i < data->num_layers; i++) {
+            ready[i] = data->layers[i].ready;
+            if (!ready[i]) waiting++;
+        }
+        // Any frame a source has ready from here on is picked up this pass
+        // or wakes the wait at the end of it
+        data->media_wake.pending = 0;
+        if (!waiting) {
+            SDL_CondWait(data->media_cond, data->media_lock);
+            continue;
+        }
+        int wanted = data->media_index;
+        float scrub = data->media_position;
+        SDL_mutexV(data->media_lock);
+
+        if (wanted != index) {
+            seek_media(data, wanted);
+            index = wanted;
+        }
+        if (scrub >= 0.0 && scrub != position) {
+            scrub_media(data, scrub);
+            position = scrub;
+        }
+
+        // How long to wait for, or forever when every source wakes us
+        int acquired = 0, poll = -1;
+        Uint32 now = SDL_GetTicks();
+        for (i = 0; i < data->num_layers; i++) {
+            sosg_layer_p layer = data->layers + i;
+            if (ready[i]) continue;
+            release_media(layer);
+            if (layer->interval && now - layer->last < layer->interval) {
+                int due = layer->interval - (now - layer->last);
+                if (poll < 0 || due < poll) poll = due;
+                continue;
+            }
+
+            double start = get_time();
+            if (layer->source->acquire_frame(layer->source_data, &layer->frame)) {
+                layer->time = get_time() - start;
+                layer->last = now;
+                layer->holding = 1;
+                layer->cut = layer->seeked;
+                layer->seeked = 0;
+                acquired++;
+            } else if (layer->source->due) {
+                int due = layer->source->due(layer->source_data);
+                if (due >= 0 && (poll < 0 || due < poll)) poll = due;
+            }
+        }
+
+        SDL_mutexP(data->media_lock);
+        for (i = 0; i < data->num_layers; i++) {
+            if (data->layers[i].holding) data->layers[i].ready = 1;
+        }
+        if (!acquired && data->media_index == wanted &&
+            data->media_position == scrub && !data->media_wake.pending) {
+            // Nothing new from the sources yet.  Those with threads wake us
+            // when they have a frame, so only layers due on an interval and
+            // sources that step by the clock need checking back on.
+            if (poll < 0)
+                SDL_CondWait(data->media_cond, data->media_lock);
+            else
+                SDL_CondWaitTimeout(data->media_cond, data->media_lock, poll);
+        }
+    }
+    SDL_mutexV(data->media_lock);
+
+    for (i = 0; i < data->num_layers; i++) release_media(data->layers + i);
+
+    return 0;
+}
+
+// Fade a layer's new frame in over the last one.  A frame after a seek
+// crossfades, and when interpolating, each image fades in over as long as
+// the last one was up, so it finishes just as the next one arrives.
+static void start_fade(sosg_p data, sosg_layer_p layer)
+{
+    double now = get_time();
+    double length = 0.0;
+
+    if (layer->cut) {
+        length = data->crossfade;
+    } else if (data->interpolate && layer->mode == SOSG_IMAGES && layer->arrived > 0.0) {
+        length = now - layer->arrived;
+        if (length > FADE_MAX) length = FADE_MAX;
+    }
+    // The first frame has nothing to fade from
+    if (!layer->shown) length = 0.0;
+
+    layer->arrived = now;
+    layer->fade_start = now;
+    layer->fade_length = length;
+}
+
+// Upload the frames the media thread prepared, if there are any.  Otherwise
+// the last frame of each layer stays up.
 static void update_media(sosg_p data)
 {
-    SDL_Surface *surface = NULL;
+    int i, ready[MAX_LAYERS], uploaded = 0;
+    float decode = 0.0;
 
-    switch (data->mode) {
-        case SOSG_IMAGES:
-            surface = sosg_image_update(data->source.images);
-            break;
-        case SOSG_VIDEO:
-            surface = sosg_video_update(data->source.video);
-            break;
-        case SOSG_PREDICT:
-            surface = sosg_predict_update(data->source.predict);
-            break;
+    SDL_mutexP(data->media_lock);
+    for (i = 0; i < data->num_layers; i++) ready[i] = data->layers[i].ready;
+    SDL_mutexV(data->media_lock);
+
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        sosg_frame_p frame = &layer->frame;
+        if (!ready[i]) continue;
+        decode += layer->time;
+
+        // Frames already on the GPU are drawn straight from their texture,
+        // once the source has drawn them if it draws its own
+        if (frame->format == SOSG_FRAME_TEXTURE && layer->source->render)
+            layer->source->render(layer->source_data, frame);
+        GLuint bound = frame->texture;
+        if (frame->format != SOSG_FRAME_TEXTURE) {
+            if (data->fade) layer->current = !layer->current;
+            load_texture(data, layer->textures + layer->current, frame);
+            bound = layer->textures[layer->current].id;
+        }
+        layer->bound[1] = layer->bound[0];
+        layer->bound[0] = bound;
+        start_fade(data, layer);
+
+        // The resolution can change between sources, so update the shader.
+        // Packed YUV frames are half again as wide as the video itself.
+        int w = frame->format == SOSG_FRAME_YUV ? frame->w*2/3 : frame->w;
+        if (w != layer->texres[0] || frame->h != layer->texres[1] || !layer->shown) {
+            layer->texres[0] = w;
+            layer->texres[1] = frame->h;
+            layer->shown = 1;
+            update_layer(data, i);
+        }
+        uploaded++;
     }
 
-    if (surface) {
-        if (data->text) {
-            SDL_Rect pos;
-            pos.x = 0;
-            // Center the text vertically
-            pos.y = surface->h/2-data->text->h/2;
-            SDL_BlitSurface(data->text, NULL, surface, &pos);
+    if (uploaded) {
+        sosg_stats_set_stage(data->perf, STATS_DECODE, decode);
+        sosg_stats_mark(data->perf, STATS_UPLOAD);
+
+        // The pixels are in the pixel buffers now, so the sources can move on
+        SDL_mutexP(data->media_lock);
+        for (i = 0; i < data->num_layers; i++) {
+            if (ready[i]) data->layers[i].ready = 0;
         }
-    
-        // TODO: Support arbitrary resolution images
-        // Check that the image's dimensions are a power of 2
-        if ((surface->w & (surface->w - 1)) != 0 ||
-            (surface->h & (surface->h - 1)) != 0) {
-            fprintf(stderr, "Warning: dimensions (%d, %d) not a power of 2\n",
-                surface->w, surface->h);
+        SDL_CondSignal(data->media_cond);
+        SDL_mutexV(data->media_lock);
+    }
+}
+
+// Draw the statistics flat over the middle of the fisheye, which is the top
+// of the globe
+static void draw_hud(sosg_p data)
+{
+    float x = data->center[0] - data->hud_size[0]/2;
+    float y = data->center[1] - data->hud_size[1]/2;
+
+    glUseProgram(0);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindTexture(GL_TEXTURE_2D, data->hud_texture);
+
+    glBegin(GL_QUADS);
+        glTexCoord2i(0, 0);
+        glVertex3f(x, y, 0);
+        glTexCoord2i(1, 0);
+        glVertex3f(x + data->hud_size[0], y, 0);
+        glTexCoord2i(1, 1);
+        glVertex3f(x + data->hud_size[0], y + data->hud_size[1], 0);
+        glTexCoord2i(0, 1);
+        glVertex3f(x, y + data->hud_size[1], 0);
+    glEnd();
+
+    glDisable(GL_BLEND);
+    glUseProgram(data->program);
+}
+
+// Render the statistics summary into the HUD texture, a line at a time since
+// SDL_ttf doesn't break lines
+static void update_hud(sosg_p data)
+{
+    SDL_Color color = {255, 255, 255};
+    SDL_Surface *lines[16];
+    char text[1024];
+    int i, num_lines = 0, w = 0, h = 0;
+
+    sosg_stats_summary(data->perf, text, sizeof(text));
+    char *line = strtok(text, "\n");
+    while (line && num_lines < 16) {
+        lines[num_lines] = TTF_RenderText_Blended(data->hud_font, line, color);
+        if (lines[num_lines]) {
+            if (lines[num_lines]->w > w) w = lines[num_lines]->w;
+            h += lines[num_lines]->h;
+            num_lines++;
         }
-    
-        load_texture(data, surface);
+        line = strtok(NULL, "\n");
+    }
+    if (!num_lines) return;
+
+    SDL_Surface *hud = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32,
+        0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+    SDL_Rect pos = {0, 0, 0, 0};
+    for (i = 0; i < num_lines; i++) {
+        if (hud) {
+            // Copy the alpha channel rather than blending with it
+            SDL_SetAlpha(lines[i], 0, SDL_ALPHA_OPAQUE);
+            SDL_BlitSurface(lines[i], NULL, hud, &pos);
+            pos.y += lines[i]->h;
+        }
+        SDL_FreeSurface(lines[i]);
     }
+    if (!hud) return;
+
+    glBindTexture(GL_TEXTURE_2D, data->hud_texture);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, hud->pitch/4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, hud->w, hud->h, 0, GL_BGRA,
+                 GL_UNSIGNED_BYTE, hud->pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, data->layers[0].textures[0].id);
+    data->hud_size[0] = hud->w;
+    data->hud_size[1] = hud->h;
+    SDL_FreeSurface(hud);
+}
+
+// Close out the frame's statistics with the source's running totals
+static void update_stats(sosg_p data)
+{
+    sosg_source_stats_t source_stats;
+    Uint64 decoded = 0, dropped = 0;
+    int i;
+
+    if (!data->perf) return;
+
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        if (!layer->source->get_stats) continue;
+        memset(&source_stats, 0, sizeof(source_stats));
+        layer->source->get_stats(layer->source_data, &source_stats);
+        decoded += source_stats.decoded;
+        dropped += source_stats.dropped;
+    }
+    sosg_stats_set(data->perf, STATS_DECODED, decoded);
+    sosg_stats_set(data->perf, STATS_DROPPED, dropped);
+
+    if (data->hud && data->hud_font && data->hud_frames-- <= 0) {
+        update_hud(data);
+        data->hud_frames = HUD_INTERVAL;
+    }
+
+    if (dump_requested) {
+        dump_requested = 0;
+        sosg_stats_dump(data->perf, data->dump_path ? data->dump_path : STATS_DUMP);
+    }
+
+    sosg_stats_mark(data->perf, STATS_HUD);
+    sosg_stats_next_frame(data->perf);
 }
 
 static void update_display(sosg_p data)
 {
+    GLuint query = 0;
+    int i;
+    
+    if (data->gpu_timer) {
+        // Only read a query back once the GPU is done with it, so this never
+        // stalls.  Until then, this frame goes untimed.
+        int q = data->gpu_query;
+        if (data->gpu_pending[q]) {
+            GLuint available = 0, elapsed;
+            glGetQueryObjectuiv(data->gpu_queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                glGetQueryObjectuiv(data->gpu_queries[q], GL_QUERY_RESULT, &elapsed);
+                sosg_stats_set_stage(data->perf, STATS_GPU, elapsed/1000000.0);
+                data->gpu_pending[q] = 0;
+            }
+        }
+        if (!data->gpu_pending[q]) {
+            query = data->gpu_queries[q];
+            glBeginQuery(GL_TIME_ELAPSED, query);
+        }
+    }
+    
     glUniform1f(data->lrotation, data->rotation);
 
     // Clear the screen before drawing
 	glClear(GL_COLOR_BUFFER_BIT);
     
-    // Bind the texture to which subsequent calls refer to
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, data->texture);
+    if (data->warp_lut) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, data->warp);
+    }
+    if (data->overlay) {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, data->overlay);
+    }
+    
+    // Bind each layer to its unit, ending with the base on the first
+    for (i = data->num_layers - 1; i >= 0; i--) {
+        sosg_layer_p layer = data->layers + i;
+        if (data->fade) {
+            // Only touch the uniform while the fade is still going
+            float fade = 1.0;
+            if (layer->fade_length > 0.0)
+                fade = (get_time() - layer->fade_start)/layer->fade_length;
+            if (fade > 1.0) fade = 1.0;
+            if (fade != layer->fade) {
+                layer->fade = fade;
+                glUniform1f(layer->lfade, fade);
+            }
+            glActiveTexture(GL_TEXTURE0 + PREV_UNIT(i));
+            glBindTexture(GL_TEXTURE_2D, layer->bound[1]);
+        }
+        glActiveTexture(GL_TEXTURE0 + LAYER_UNIT(i));
+        glBindTexture(GL_TEXTURE_2D, layer->bound[0]);
+    }
 
     // Just make a full screen quad, a canvas for the shader to draw on
     glBegin(GL_QUADS);
@@ -364,8 +1091,18 @@ static void update_display(sosg_p data)
         glTexCoord2i(0, 1);
         glVertex3f(0, data->h, 0);
     glEnd();
+    
+    if (data->hud && data->hud_size[0]) draw_hud(data);
+    
+    if (query) {
+        glEndQuery(GL_TIME_ELAPSED);
+        data->gpu_pending[data->gpu_query] = 1;
+        data->gpu_query = (data->gpu_query + 1) % GPU_QUERIES;
+    }
+    sosg_stats_mark(data->perf, STATS_DRAW);
 	
     SDL_GL_SwapBuffers();
+    sosg_stats_mark(data->perf, STATS_SWAP);
 }
 
 static void update_input(sosg_p data)
@@ -376,15 +1113,106 @@ static void update_input(sosg_p data)
         sosg_tracker_get_rotation(data->tracker, &rotation, &mode);
         if (mode == TRACKER_ROTATE)
             data->rotation = -rotation;
-        else if (mode == TRACKER_SCROLL) {
+        else if (mode == TRACKER_SCROLL && data->scrub) {
+            // A full turn of the Tracker covers the whole video
+            float position = fmod(rotation, 2.0*M_PI)/(2.0*M_PI);
+            if (position < 0.0) position += 1.0;
+            update_position(data, position);
+        } else if (mode == TRACKER_SCROLL) {
             data->index = rotation / (M_PI/3.0);
             update_index(data);
         }
     } else {
-        data->rotation += data->drotation;
+        data->rotation += data->drotation*data->elapsed/TICK_INTERVAL;
     }
 }
 
+// Whether len characters at s make the optional layer field that comes
+// which-th after the path: an opacity, a blend mode, or frames per second
+static int layer_field(int which, const char *s, int len)
+{
+    char field[32], *end;
+    int i;
+
+    if (len <= 0 || len >= (int)sizeof(field)) return 0;
+    memcpy(field, s, len);
+    field[len] = '\0';
+    if (which == 1) {
+        for (i = 0; i < BLEND_NUM_MODES; i++) {
+            if (!strcmp(field, blend_names[i])) return 1;
+        }
+        return 0;
+    }
+    strtod(field, &end);
+    return !*end;
+}
+
+// Add a layer over the base from a spec like v:clouds.mp4:0.8:add:10, which
+// is the kind of source, its path, then optionally the opacity, blend mode
+// and frames per second.  Paths can hold colons, as URLs do, so the optional
+// fields are taken from the right, as many as look like them.
+static int add_layer(sosg_p data, char *spec)
+{
+    int i, j, n = 0;
+    char *colons[3], *fields[3] = {NULL, NULL, NULL};
+
+    if (data->num_layers >= MAX_LAYERS) {
+        fprintf(stderr, "Error: No more than %d layers\n", MAX_LAYERS);
+        return 1;
+    }
+    sosg_layer_p layer = data->layers + data->num_layers;
+
+    char *kind = spec;
+    char *path = strchr(spec, ':');
+    if (path) {
+        *path++ = '\0';
+        int len = strlen(path);
+        for (i = len - 1; i > 0 && n < 3; i--) {
+            if (path[i] == ':') colons[n++] = path + i;
+        }
+        // Try the most fields first, so 1:add:10 isn't left in the path
+        for (; n > 0; n--) {
+            for (j = 0; j < n; j++) {
+                char *end = j == n - 1 ? path + len : colons[n - 2 - j];
+                if (!layer_field(j, colons[n - 1 - j] + 1, end - colons[n - 1 - j] - 1)) break;
+            }
+            if (j == n) break;
+        }
+        for (j = 0; j < n; j++) {
+            *colons[n - 1 - j] = '\0';
+            fields[j] = colons[n - 1 - j] + 1;
+        }
+    }
+    char *opacity = fields[0];
+    char *blend = fields[1];
+    char *fps = fields[2];
+    if (!path || !*path || strlen(kind) != 1 || !strchr("ivp", kind[0])) {
+        fprintf(stderr, "Error: Layers are i, v or p, then a path\n");
+        return 1;
+    }
+
+    layer->mode = kind[0] == 'v' ? SOSG_VIDEO : kind[0] == 'p' ? SOSG_PREDICT : SOSG_IMAGES;
+    layer->path = path;
+    layer->opacity = opacity ? atof(opacity) : 1.0;
+    layer->blend = BLEND_NORMAL;
+    if (blend) {
+        for (i = 0; i < BLEND_NUM_MODES && strcmp(blend, blend_names[i]); i++);
+        if (i == BLEND_NUM_MODES) {
+            fprintf(stderr, "Error: Unknown blend mode %s\n", blend);
+            return 1;
+        }
+        layer->blend = i;
+    }
+    if (fps && atof(fps) > 0.0) {
+        // Image layers also play through their images at this speed
+        layer->fps = atof(fps);
+        layer->interval = 1000.0/layer->fps;
+    }
+
+    data->num_layers++;
+    return 0;
+}
+
 static void usage(sosg_p data)
 {
     printf("Usage: sosg [OPTION] [FILES]\n\n");
@@ -395,8 +1223,18 @@ static void usage(sosg_p data)
     printf("    Input Data\n");
     printf("        -i     Display an image or slideshow (Default)\n");
     printf("        -v     Display a video or videos\n");
-    printf("        -p     Satellite tracking as a PREDICT client\n");
-    printf("        -s     Optional string to overlay\n\n");
+    printf("        -Y     Decode video as planar YUV and convert it on the GPU\n");
+    printf("        -S     Scrub through a video with the Tracker instead of switching\n");
+    printf("        -p     Satellite tracking from TLE files, or as a PREDICT client\n");
+    printf("        -B     Benchmark -p with this many more made up satellites for %d seconds\n", BENCH_SECONDS);
+    printf("        -L     Add a layer over the others, as kind:path[:opacity[:blend[:fps]]]\n");
+    printf("        -a     Play images as a time-lapse at this many fps, negative for backwards\n");
+    printf("        -A     Time-lapse playback as loop, pingpong or once (loop)\n");
+    printf("        -X     Crossfade between items over this many milliseconds\n");
+    printf("        -I     Interpolate between images by fading each into the next\n");
+    printf("        -s     Optional string to overlay\n");
+    printf("        -m     Image cache size in megabytes (%d)\n", data->cache_mb);
+    printf("        -c     Reduce sources to the resolution the globe can display\n\n");
     printf("    Snow Globe Configuration\n");
     printf("        -f     Fullscreen\n");
     printf("        -w     Display width in pixels (%d)\n", data->w);
@@ -404,39 +1242,95 @@ static void usage(sosg_p data)
     printf("        -r     Radius in pixels (%.1f)\n", data->radius);
     printf("        -x     X offset in pixels (%.1f)\n", data->center[0]);
     printf("        -y     Y offset in pixels (%.1f)\n", data->center[1]);
-    printf("        -o     Lens offset in pixels (%.1f)\n\n", data->height);
+    printf("        -o     Lens offset in pixels (%.1f)\n", data->height);
+    printf("        -l     Warp with a precomputed lookup table\n");
+    printf("        -n     Pace frames with a timer instead of vsync\n");
+    printf("        -d     Print performance statistics\n");
+    printf("        -D     Write per frame statistics to a .csv or .json file\n\n");
     printf("    Adjacent Reality Tracker (optional)\n");
     printf("        -t     Path to the Tracker device\n\n");
     printf("The left and right arrow keys can be used to rotate the sphere.\n");
     printf("Holding shift while using the arrows changes rotation speed.\n");
     printf("p will stop the rotation and r resets the angle.\n");
+    printf("l switches between analytic and lookup table warping.\n");
+    printf("h shows statistics on the globe when they are enabled.\n");
     printf("The up and down arrow keys go to the previous or next image in image mode.\n\n");
 }
 
 static void cleanup(sosg_p data)
 {
-    switch (data->mode) {
-        case SOSG_IMAGES:
-            sosg_image_destroy(data->source.images);
-            break;
-        case SOSG_VIDEO:
-            sosg_video_destroy(data->source.video);
-            break;
-        case SOSG_PREDICT:
-            sosg_predict_destroy(data->source.predict);
-            break;
+    sosg_source_stats_t source_stats;
+    int i;
+
+    // Stop the media thread before the sources go away
+    if (data->media_thread) {
+        SDL_mutexP(data->media_lock);
+        data->media_running = 0;
+        SDL_CondSignal(data->media_cond);
+        SDL_mutexV(data->media_lock);
+        SDL_WaitThread(data->media_thread, NULL);
+    }
+    if (data->media_cond) SDL_DestroyCond(data->media_cond);
+    if (data->media_lock) SDL_DestroyMutex(data->media_lock);
+
+    if (data->stats) {
+        printf("Frame times (%s):\n", data->vsync ? "vsync" : "timer");
+        for (i = 0; i < FRAME_BINS; i++) {
+            if (data->frame_hist[i])
+                printf("  %2d%s ms: %d\n", i, i == FRAME_BINS - 1 ? "+" : " ",
+                    data->frame_hist[i]);
+        }
+    }
+
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        if (!layer->source_data) continue;
+        if (data->stats && layer->source->get_stats) {
+            memset(&source_stats, 0, sizeof(source_stats));
+            layer->source->get_stats(layer->source_data, &source_stats);
+            printf("%s: %d decoded, %d presented, %d dropped\n", layer->source->name,
+                source_stats.decoded, source_stats.presented, source_stats.dropped);
+            if (source_stats.switches) {
+                printf("%s: %d switches, %d ms last, %d ms max\n", layer->source->name,
+                    source_stats.switches, source_stats.switch_last,
+                    source_stats.switch_max);
+            }
+            if (source_stats.late) {
+                printf("%s: %d frames late, %d ms max\n", layer->source->name,
+                    source_stats.late, source_stats.late_max);
+            }
+            if (source_stats.refreshes) {
+                printf("%s: %d refreshes, %d ms last, %d ms max, %d of %d requests lost\n",
+                    layer->source->name, source_stats.refreshes, source_stats.refresh_last,
+                    source_stats.refresh_max, source_stats.lost, source_stats.requests);
+            }
+        }
+        if (layer->source->destroy) layer->source->destroy(layer->source_data);
     }
     
-    // Now we can delete the OpenGL texture and close down SDL
-    glDeleteTextures(1, &data->texture);
+    // Now we can delete the OpenGL objects and close down SDL
+    unload_shaders(data);
+    for (i = 0; i < data->num_layers; i++) {
+        if (data->layers[i].textures[0].id) glDeleteTextures(1, &data->layers[i].textures[0].id);
+        if (data->layers[i].textures[1].id) glDeleteTextures(1, &data->layers[i].textures[1].id);
+    }
+    if (data->pbo[0]) glDeleteBuffers(PBO_COUNT, data->pbo);
+    if (data->warp) glDeleteTextures(1, &data->warp);
+    if (data->overlay) glDeleteTextures(1, &data->overlay);
+    if (data->gpu_timer) glDeleteQueries(GPU_QUERIES, data->gpu_queries);
+    if (data->hud_texture) glDeleteTextures(1, &data->hud_texture);
+    if (data->hud_font) TTF_CloseFont(data->hud_font);
+    if (data->stats) TTF_Quit();
+    if (data->dump_path) sosg_stats_dump(data->perf, data->dump_path);
+    sosg_stats_destroy(data->perf);
     if (data->text) SDL_FreeSurface(data->text);
     SDL_Quit();
 }
 
 int main(int argc, char *argv[])
 {
-    int c;
-    char *filename = NULL;
+    int c, i;
+    sosg_source_config_t config;
     
     sosg_p data = calloc(1, sizeof(sosg_t));
     if (!data) {
@@ -452,8 +1346,14 @@ int main(int argc, char *argv[])
     data->center[0] = 431.0;
     data->center[1] = 210.0;
     data->rotation = M_PI;
+    data->cache_mb = IMAGE_CACHE_MB;
+    data->vsync = 1;
+    data->media_position = -1.0;
+    // The base layer comes from the files at the end
+    data->num_layers = 1;
+    data->layers[0].opacity = 1.0;
     
-    while ((c = getopt(argc, argv, "ivpfs:w:g:r:x:y:o:t:")) != -1) {
+    while ((c = getopt(argc, argv, "ivYSpB:L:a:A:X:Ifs:m:cw:g:r:x:y:o:lndD:t:")) != -1) {
         switch (c) {
             case 'i':
                 data->mode = SOSG_IMAGES;
@@ -461,15 +1361,64 @@ int main(int argc, char *argv[])
             case 'v':
                 data->mode = SOSG_VIDEO;
                 break;
+            case 'Y':
+                data->yuv = 1;
+                break;
+            case 'S':
+                data->scrub = 1;
+                break;
             case 'p':
                 data->mode = SOSG_PREDICT;
                 break;
+            case 'B':
+                data->bench = atoi(optarg);
+                if (data->bench <= 0) {
+                    fprintf(stderr, "Error: Benchmark needs a positive number of satellites, not %s\n", optarg);
+                    return 1;
+                }
+                data->mode = SOSG_PREDICT;
+                data->stats = 1;
+                break;
+            case 'L':
+                if (add_layer(data, optarg)) return 1;
+                break;
+            case 'a':
+                data->fps = atof(optarg);
+                break;
+            case 'A':
+                if (!strcmp(optarg, "pingpong")) {
+                    data->playback = IMAGE_PINGPONG;
+                } else if (!strcmp(optarg, "once")) {
+                    data->playback = IMAGE_ONCE;
+                } else if (!strcmp(optarg, "loop")) {
+                    data->playback = IMAGE_LOOP;
+                } else {
+                    fprintf(stderr, "Error: Unknown playback %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'X':
+                data->crossfade = atoi(optarg);
+                break;
+            case 'I':
+                data->interpolate = 1;
+                break;
             case 'f':
                 data->fullscreen = 1;
                 break;
             case 's':
                 setup_overlay(data, optarg);
                 break;
+            case 'm':
+                data->cache_mb = atoi(optarg);
+                if (data->cache_mb <= 0) {
+                    fprintf(stderr, "Error: Image cache size %s is not a positive number of megabytes\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c':
+                data->reduce = 1;
+                break;
             case 'w':
                 data->w = atoi(optarg);
                 break;
@@ -488,6 +1437,19 @@ int main(int argc, char *argv[])
             case 'o':
                 data->height = atof(optarg);
                 break;
+            case 'l':
+                data->warp_lut = 1;
+                break;
+            case 'n':
+                data->vsync = 0;
+                break;
+            case 'd':
+                data->stats = 1;
+                break;
+            case 'D':
+                data->stats = 1;
+                data->dump_path = optarg;
+                break;
             case 't':
                 data->tracker = sosg_tracker_init(optarg);
                 if (!data->tracker)
@@ -507,30 +1469,58 @@ int main(int argc, char *argv[])
         return 1;
     }
     
-    // Pick the last non-option arg as the filename to use
-    filename = argv[argc-1];
+    data->layers[0].mode = data->mode;
+    data->fade = data->crossfade > 0 || data->interpolate;
+    for (i = 0; i < data->num_layers; i++) {
+        data->layers[i].source = sources[data->layers[i].mode];
+        // Until the source reports its resolution
+        data->layers[i].texres[0] = 1;
+        data->layers[i].texres[1] = 1;
+    }
+    
+    // Only video can be decoded to YUV
+    if (data->mode != SOSG_VIDEO) data->yuv = 0;
+    // Only video can be scrubbed
+    if (data->mode != SOSG_VIDEO) data->scrub = 0;
+    
+    // Sources don't need to keep more detail or latitudes than the
+    // calibration can show
+    sosg_warp_limits(data->radius, data->height, &data->limits);
+    if (!data->reduce) {
+        data->limits.resolution[0] = 0;
+        data->limits.resolution[1] = 0;
+    }
     
     if (setup(data)) {
         cleanup(data);
         return 1;
     }
     
-    switch (data->mode) {
-        case SOSG_IMAGES:
-            // The remaining args are assumed to be filenames.  getopt
-            // reorders the argv to put non option args at the end on all 
+    for (i = 0; i < data->num_layers; i++) {
+        sosg_layer_p layer = data->layers + i;
+        memset(&config, 0, sizeof(config));
+        if (i == 0) {
+            // The remaining args are the paths for the base.  getopt
+            // reorders the argv to put non option args at the end on all
             // platforms I know of, but it is not the POSIX standard to do so.
-            data->source.images = sosg_image_init(argc-optind, argv+optind);
-            sosg_image_get_resolution(data->source.images, data->texres);
-            break;
-        case SOSG_VIDEO:
-            data->source.video = sosg_video_init(argc-optind, argv+optind);
-            sosg_video_get_resolution(data->source.video, data->texres);
-            break;
-        case SOSG_PREDICT:
-            data->source.predict = sosg_predict_init(filename);
-            sosg_predict_get_resolution(data->source.predict, data->texres);
-            break;
+            config.num_paths = argc-optind;
+            config.paths = argv+optind;
+            config.yuv = data->yuv;
+            config.scrub = data->scrub;
+            config.fps = data->fps;
+            config.synthetic = data->bench;
+        } else {
+            config.num_paths = 1;
+            config.paths = &layer->path;
+            config.fps = layer->fps;
+        }
+        config.playback = data->playback;
+        config.cache_mb = data->cache_mb;
+        config.limits = &data->limits;
+        config.wake = &data->media_wake;
+        layer->source_data = layer->source->init(&config);
+        if (layer->source->get_resolution)
+            layer->source->get_resolution(layer->source_data, layer->texres);
     }
     
     if (load_shaders(data)) {
@@ -538,13 +1528,29 @@ int main(int argc, char *argv[])
         return 1;
     }
     
+    if (data->stats) data->perf = sosg_stats_init();
+    
+    data->media_running = 1;
+    data->media_thread = SDL_CreateThread(media_loop, data);
+    
+    Uint32 bench_end = SDL_GetTicks() + BENCH_SECONDS*1000;
     while (handle_events(data) != -1) {
+        sosg_stats_mark(data->perf, STATS_EVENTS);
         update_media(data);
         update_display(data);
         update_timer(data);
+        sosg_stats_mark(data->perf, STATS_WAIT);
         update_input(data);
+        sosg_stats_mark(data->perf, STATS_INPUT);
+        update_stats(data);
+        if (data->bench && SDL_GetTicks() >= bench_end) break;
     }
     
+    if (data->bench) {
+        char text[512];
+        sosg_stats_summary(data->perf, text, sizeof(text));
+        printf("Benchmark of %d synthetic satellites, the last frames:\n%s\n", data->bench, text);
+    }
     cleanup(data);
 	return 0;
 }
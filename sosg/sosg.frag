@@ -1,19 +1,144 @@
 uniform sampler2D tex;
+uniform sampler2D warp;
+uniform sampler2D overlay;
 uniform float radius;
 uniform float height;
 uniform float ratio;
 uniform float rotation;
 uniform vec2 center;
 uniform vec2 texres;
+uniform vec2 band;
+// Left edge and top of the overlay on the source, then its inverse size
+uniform vec4 overlay_rect;
+#if LAYERS > 0
+uniform sampler2D layer1;
+#endif
+#if LAYERS > 1
+uniform sampler2D layer2;
+#endif
+#if LAYERS > 2
+uniform sampler2D layer3;
+#endif
+#if LAYERS > 0
+// For each layer over the base, its inverse resolution, then its opacity,
+// blend mode and whether to use its alpha channel
+uniform vec2 layer_texres[LAYERS];
+uniform vec3 layer_mix[LAYERS];
+#endif
+#ifdef FADE
+// The frame each layer is fading from, and how far along the fade is
+uniform sampler2D prev0;
+#if LAYERS > 0
+uniform sampler2D prev1;
+#endif
+#if LAYERS > 1
+uniform sampler2D prev2;
+#endif
+#if LAYERS > 2
+uniform sampler2D prev3;
+#endif
+uniform float fade[LAYERS + 1];
+#endif
 
 #define SIN_PI_4 0.7071067811865475
 #define PI2 6.283185307179586
 #define PI 3.141592653589793
 #define PI_2 1.5707963267948966
 
+#ifdef YUV
+// Planar YUV frames are packed into one 8 bit texture, with luma on the left
+// two thirds and chroma on the right with U and V on alternating rows.
+// Filtering is linear, so the raw Y, U and V are filtered here and only
+// converted to RGB once at the end.
+vec4 sample(sampler2D source, vec2 uv)
+{
+    float x = fract(uv.x);
+    // Stay half a texel away from the edges so nothing bleeds between planes
+    float lx = clamp(x, 0.5*texres.x, 1.0 - 0.5*texres.x)*(2.0/3.0);
+    float cx = 2.0/3.0 + clamp(x, texres.x, 1.0 - texres.x)/3.0;
+    // Sample chroma on the center of a U row so V never gets mixed in
+    float row = (floor(uv.y/(2.0*texres.y))*2.0 + 0.5)*texres.y;
+    return vec4(texture2D(source, vec2(lx, uv.y)).r,
+                texture2D(source, vec2(cx, row)).r,
+                texture2D(source, vec2(cx, row + texres.y)).r, 1.0);
+}
+#else
+vec4 sample(sampler2D source, vec2 uv)
+{
+    return texture2D(source, uv);
+}
+#endif
+
+// A really naive filter to reduce sparkling
+vec4 base(sampler2D source, vec2 uv)
+{
+    vec4 color = sample(source, uv + vec2(-texres[0], 0.0));
+    color += sample(source, uv + vec2(texres[0], 0.0));
+    color += sample(source, uv + vec2(0.0, texres[1]));
+    color += sample(source, uv + vec2(0.0, -texres[1]));
+    return color/8.0 + sample(source, uv)*0.5;
+}
+
+#if LAYERS > 0
+// The same filter as the base gets, for layers that are always RGBA
+vec4 filtered(sampler2D layer, vec2 uv, vec2 res)
+{
+    vec4 color = texture2D(layer, uv + vec2(-res.x, 0.0));
+    color += texture2D(layer, uv + vec2(res.x, 0.0));
+    color += texture2D(layer, uv + vec2(0.0, res.y));
+    color += texture2D(layer, uv + vec2(0.0, -res.y));
+    return color/8.0 + texture2D(layer, uv)*0.5;
+}
+
+// Blend modes are normal, add and multiply, in the order of enum sosg_blend
+vec4 blend(vec4 color, vec4 over, vec3 mix_)
+{
+    float alpha = mix_.x*(mix_.z > 0.5 ? over.a : 1.0);
+    vec3 blended = over.rgb;
+    if (mix_.y > 1.5) blended *= color.rgb;
+    else if (mix_.y > 0.5) blended += color.rgb;
+    color.rgb = mix(color.rgb, blended, alpha);
+    return color;
+}
+
+#ifdef FADE
+// Only sample the previous frame while it is still fading out
+vec4 faded(sampler2D current, sampler2D previous, vec2 uv, vec2 res, float t)
+{
+    vec4 color = filtered(current, uv, res);
+    if (t < 1.0) color = mix(filtered(previous, uv, res), color, t);
+    return color;
+}
+#define LAYER(current, previous, uv, i) faded(current, previous, uv, layer_texres[i], fade[i + 1])
+#else
+#define LAYER(current, previous, uv, i) filtered(current, uv, layer_texres[i])
+#endif
+#endif
+
+#ifdef OVERLAY
+// The overlay wraps around in longitude like the source does
+vec4 composite(vec4 color, vec2 uv)
+{
+    vec2 st = vec2(fract(uv.x - overlay_rect.x), uv.y - overlay_rect.y)*overlay_rect.zw;
+    if (st.x < 1.0 && st.y >= 0.0 && st.y < 1.0) {
+        vec4 over = texture2D(overlay, st);
+        color.rgb = mix(color.rgb, over.rgb, over.a);
+    }
+    return color;
+}
+#endif
+
 void main(void)
 {
     vec4 color = vec4(0.0);
+#ifdef WARP_LUT
+    // The warp was baked into a screen space table by sosg_warp_lut()
+    vec4 warped = texture2D(warp, gl_TexCoord[0].st);
+    if (warped.a < 0.5) {
+        gl_FragColor = color;
+    } else {
+        vec2 fisheye = vec2(warped.r + rotation/PI2, warped.g*2.0);
+#else
     vec2 offset = (gl_TexCoord[0].st - center)*vec2(ratio, 1.0);
     float d = length(offset);
     if (d > radius) {
@@ -24,14 +149,33 @@ void main(void)
         float theta = asin(height*h)+asin(h);
         float phi = atan(offset[0],offset[1]);
         vec2 fisheye = vec2((rotation-phi)/PI2, theta/PI_2);
+#endif
+        // The source only holds the latitudes between band.x and the rim
+        fisheye.y = (fisheye.y - band.x)*band.y;
         
-        // A really naive filter to reduce sparkling
-        color += texture2D(tex, fisheye + vec2(-texres[0], 0.0));
-        color += texture2D(tex, fisheye + vec2(texres[0], 0.0));
-        color += texture2D(tex, fisheye + vec2(0.0, texres[1]));
-        color += texture2D(tex, fisheye + vec2(0.0, -texres[1]));
-        color /= 8.0;
-        color += texture2D(tex, fisheye)*0.5;
+        color = base(tex, fisheye);
+#ifdef FADE
+        // YUV is converted after mixing, which is fine since it is linear
+        if (fade[0] < 1.0) color = mix(base(prev0, fisheye), color, fade[0]);
+#endif
+#ifdef YUV
+        // BT.709 with limited range, since SOS movies are HD or larger
+        color.rgb = mat3(1.164, 1.164, 1.164,
+                         0.0, -0.213, 2.112,
+                         1.793, -0.533, 0.0)*(color.rgb - vec3(0.0625, 0.5, 0.5));
+#endif
+#if LAYERS > 0
+        color = blend(color, LAYER(layer1, prev1, fisheye, 0), layer_mix[0]);
+#endif
+#if LAYERS > 1
+        color = blend(color, LAYER(layer2, prev2, fisheye, 1), layer_mix[1]);
+#endif
+#if LAYERS > 2
+        color = blend(color, LAYER(layer3, prev3, fisheye, 2), layer_mix[2]);
+#endif
+#ifdef OVERLAY
+        color = composite(color, fisheye);
+#endif
 	    gl_FragColor = color;
 	}
 }
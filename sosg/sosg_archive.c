@@ -0,0 +1,152 @@
+#include "sosg_archive.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lz4.h>
+
+typedef struct sosg_archive_struct {
+    int fd;
+    Uint8 *map;
+    size_t size;
+    int num_frames;
+    sosg_archive_frame_t *frames;
+} sosg_archive_t;
+
+int sosg_archive_check(const char *path)
+{
+    sosg_archive_header_t header;
+    int is_archive = 0;
+
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        if (fread(&header, sizeof(header), 1, fp) == 1)
+            is_archive = !memcmp(header.magic, SOSG_ARCHIVE_MAGIC, sizeof(header.magic));
+        fclose(fp);
+    }
+
+    return is_archive;
+}
+
+static int sosg_archive_load(sosg_archive_p archive, const char *path)
+{
+    struct stat st;
+    int i;
+
+    archive->fd = open(path, O_RDONLY);
+    if (archive->fd == -1 || fstat(archive->fd, &st)) {
+        fprintf(stderr, "Error: Could not open archive %s\n", path);
+        return -1;
+    }
+    archive->size = st.st_size;
+
+    // The map is private and writable so anything drawn into a frame stays
+    // local to this process instead of touching the file or the page cache
+    archive->map = mmap(NULL, archive->size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, archive->fd, 0);
+    if (archive->map == MAP_FAILED) {
+        archive->map = NULL;
+        fprintf(stderr, "Error: Could not map archive %s\n", path);
+        return -1;
+    }
+
+    sosg_archive_header_t *header = (sosg_archive_header_t *)archive->map;
+    if (archive->size < sizeof(sosg_archive_header_t) ||
+        memcmp(header->magic, SOSG_ARCHIVE_MAGIC, sizeof(header->magic)) ||
+        header->version != SOSG_ARCHIVE_VERSION) {
+        fprintf(stderr, "Error: %s is not a version %d archive\n", path,
+            SOSG_ARCHIVE_VERSION);
+        return -1;
+    }
+
+    // Everything in the table is checked in 64 bits so a bad one can't wrap
+    // around and point a frame outside of the map
+    if (header->num_frames > SOSG_ARCHIVE_MAX_FRAMES ||
+        sizeof(sosg_archive_header_t) + (Uint64)header->num_frames*sizeof(sosg_archive_frame_t)
+            > archive->size) {
+        fprintf(stderr, "Error: Truncated frame table in %s\n", path);
+        return -1;
+    }
+    archive->num_frames = header->num_frames;
+    archive->frames = (sosg_archive_frame_t *)(archive->map + sizeof(sosg_archive_header_t));
+
+    for (i = 0; i < archive->num_frames; i++) {
+        sosg_archive_frame_t *frame = archive->frames + i;
+        // SDL 1.2 keeps the pitch of a surface in 16 bits
+        if (!frame->w || !frame->h || frame->w > SOSG_ARCHIVE_MAX_WIDTH ||
+            frame->h > SOSG_ARCHIVE_MAX_WIDTH || frame->pitch < 4*frame->w ||
+            frame->pitch > 0xFFFF) {
+            fprintf(stderr, "Error: Frame %d of %s is %ux%u with a pitch of %u\n", i, path,
+                frame->w, frame->h, frame->pitch);
+            return -1;
+        }
+        Uint64 frame_size = (Uint64)frame->pitch*frame->h;
+        if (frame->offset > archive->size || frame->size > archive->size - frame->offset ||
+            (!(frame->flags & SOSG_ARCHIVE_LZ4) && frame->size < frame_size)) {
+            fprintf(stderr, "Error: Frame %d is past the end of %s\n", i, path);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+sosg_archive_p sosg_archive_open(const char *path)
+{
+    sosg_archive_p archive = calloc(1, sizeof(sosg_archive_t));
+    if (archive) {
+        archive->fd = -1;
+        if (sosg_archive_load(archive, path)) {
+            sosg_archive_close(archive);
+            return NULL;
+        }
+    }
+
+    return archive;
+}
+
+void sosg_archive_close(sosg_archive_p archive)
+{
+    if (archive) {
+        if (archive->map) munmap(archive->map, archive->size);
+        if (archive->fd != -1) close(archive->fd);
+        free(archive);
+    }
+}
+
+int sosg_archive_num_frames(sosg_archive_p archive)
+{
+    return archive ? archive->num_frames : 0;
+}
+
+SDL_Surface *sosg_archive_get_frame(sosg_archive_p archive, int index)
+{
+    SDL_Surface *surface = NULL;
+
+    if (!archive || index < 0 || index >= archive->num_frames) return NULL;
+
+    sosg_archive_frame_t *frame = archive->frames + index;
+    Uint8 *pixels = archive->map + frame->offset;
+
+    if (frame->flags & SOSG_ARCHIVE_LZ4) {
+        surface = SDL_CreateRGBSurface(SDL_SWSURFACE, frame->w, frame->h, 32,
+            0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+        if (surface && LZ4_decompress_safe((const char *)pixels, surface->pixels,
+                frame->size, surface->pitch*surface->h) != surface->pitch*surface->h) {
+            fprintf(stderr, "Warning: Could not decompress frame %d\n", index);
+            SDL_FreeSurface(surface);
+            surface = NULL;
+        }
+    } else {
+        // Wrap the mapped frame without a copy, and start paging it in now
+        // rather than during the texture upload
+        madvise(pixels - (frame->offset % SOSG_ARCHIVE_ALIGN),
+            frame->size + (frame->offset % SOSG_ARCHIVE_ALIGN), MADV_WILLNEED);
+        surface = SDL_CreateRGBSurfaceFrom(pixels, frame->w, frame->h, 32,
+            frame->pitch, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+    }
+
+    return surface;
+}
@@ -0,0 +1,46 @@
+#ifndef _SOSG_ARCHIVE_H_
+#define _SOSG_ARCHIVE_H_
+
+#include "SDL.h"
+
+// A packed data set is a header, a table of frames, and then the frames
+// themselves as raw 32 bit ARGB (or LZ4 compressed), each starting on a page
+// boundary so they can be used straight out of a memory map.  Everything is
+// stored in the byte order of the machine that packed it.
+#define SOSG_ARCHIVE_MAGIC "SOSGPACK"
+#define SOSG_ARCHIVE_VERSION 1
+#define SOSG_ARCHIVE_ALIGN 4096
+// Limits a reader holds a packed data set to, so a bad table can't ask for
+// more than it could hold
+#define SOSG_ARCHIVE_MAX_FRAMES (1 << 24)
+#define SOSG_ARCHIVE_MAX_WIDTH 16383
+
+enum sosg_archive_flags {
+    SOSG_ARCHIVE_LZ4 = 1
+};
+
+typedef struct sosg_archive_header_struct {
+    char magic[8];
+    Uint32 version;
+    Uint32 num_frames;
+} sosg_archive_header_t;
+
+typedef struct sosg_archive_frame_struct {
+    Uint64 offset;
+    Uint32 size;
+    Uint32 flags;
+    Uint32 w;
+    Uint32 h;
+    Uint32 pitch;
+    Uint32 reserved;
+} sosg_archive_frame_t, *sosg_archive_frame_p;
+
+typedef struct sosg_archive_struct *sosg_archive_p;
+
+int sosg_archive_check(const char *path);
+sosg_archive_p sosg_archive_open(const char *path);
+void sosg_archive_close(sosg_archive_p archive);
+int sosg_archive_num_frames(sosg_archive_p archive);
+SDL_Surface *sosg_archive_get_frame(sosg_archive_p archive, int index);
+
+#endif /* _SOSG_ARCHIVE_H_ */
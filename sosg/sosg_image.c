@@ -1,87 +1,486 @@
 #include "sosg_image.h"
+#include "sosg_archive.h"
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <jpeglib.h>
 
-#define PRELOAD_IMAGES 5
+#define MAX_LOAD_THREADS 16
+// Images kept behind the current one during playback, for stepping back
+#define PLAY_BEHIND 2
+// Least time between warnings that playback is running late
+#define LATE_WARNING 5000
+
+enum img_state {
+    IMG_EMPTY,
+    IMG_LOADING,
+    IMG_READY,
+    IMG_FAILED
+};
 
 typedef struct img_struct {
     char *path;
     SDL_Surface *buffer;
+    int state;
 } img_t, *img_p;
 
 typedef struct sosg_image_struct {
     int num_images;
     int num_loaded;
+    int decoded;
+    int failed;
+    int presented;
     int index;
     int last_index;
+    int shown;
     int updated;
     int running;
-    SDL_Thread *load_thread;
+    int resolution[2];
+    size_t cache_size;
+    size_t cache_used;
+    int frame_size;
+    int num_threads;
+    SDL_Thread *load_threads[MAX_LOAD_THREADS];
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    SDL_cond *loaded;
+    sosg_archive_p archive;
+    sosg_limits_t limits;
+    sosg_wake_p ready;
     img_p *images;
+    // Time-lapse playback, paced by SDL ticks
+    float fps;
+    int playback;
+    int direction;
+    Uint32 due;
+    Uint32 stepped;
+    float decode_ms;
+    int late;
+    int late_max;
+    Uint32 late_warned;
+    int lead_warned;
 } sosg_image_t;
 
-static void load_image(img_p img)
+typedef struct jpeg_error_struct {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} jpeg_error_t, *jpeg_error_p;
+
+static void jpeg_error(j_common_ptr cinfo)
+{
+    // The default handler exits the process, so jump back to the loader
+    longjmp(((jpeg_error_p)cinfo->err)->jump, 1);
+}
+
+// Decode a JPEG with libjpeg directly so it can scale down in the DCT, which
+// is much cheaper than decoding at full size and filtering afterwards.  The
+// factor that is left over for the box filter is passed back.
+static SDL_Surface *load_jpeg(const char *path, sosg_limits_p limits, int *factor)
+{
+    struct jpeg_decompress_struct cinfo;
+    jpeg_error_t err;
+    // These are volatile since they are used again after a longjmp
+    SDL_Surface * volatile buffer = NULL;
+    JSAMPLE * volatile row = NULL;
+    unsigned int x, scale;
+    int rows[2];
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        if (buffer) SDL_FreeSurface(buffer);
+        if (row) free(row);
+        fclose(fp);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, fp);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // libjpeg can only scale both axes together, by up to 8
+    sosg_warp_reduction(limits, cinfo.image_width, cinfo.image_height, factor);
+    scale = factor[0] < factor[1] ? factor[0] : factor[1];
+    if (scale > 8) scale = 8;
+    factor[0] /= scale;
+    factor[1] /= scale;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale;
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+
+    // Only the rows in the latitude band are kept
+    sosg_warp_band_rows(limits, cinfo.output_height, rows);
+    buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, cinfo.output_width,
+        rows[1], 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+    row = malloc(cinfo.output_width*3);
+    if (!buffer || !row) longjmp(err.jump, 1);
+
+    // Stop decoding as soon as we are past the band
+    while (cinfo.output_scanline < rows[0] + rows[1]) {
+        int y = cinfo.output_scanline - rows[0];
+        JSAMPROW in = row;
+        jpeg_read_scanlines(&cinfo, &in, 1);
+        if (y < 0) continue;
+        Uint32 *out = (Uint32 *)((Uint8 *)buffer->pixels + y*buffer->pitch);
+        for (x = 0; x < cinfo.output_width; x++, in += 3) {
+            *out++ = 0xFF000000 | (in[0] << 16) | (in[1] << 8) | in[2];
+        }
+    }
+
+    // Destroying without finishing is fine when skipping the last rows
+    jpeg_destroy_decompress(&cinfo);
+    free(row);
+    fclose(fp);
+
+    return buffer;
+}
+
+// Average two packed ARGB pixels per channel without unpacking them, so the
+// filter loops work on whole pixels and vectorize well
+#define AVERAGE(a, b) (((a) & (b)) + ((((a) ^ (b)) & 0xFEFEFEFE) >> 1))
+
+// Box filter the surface down by power of two factors on each axis
+static SDL_Surface *reduce_surface(SDL_Surface *surface, int *factor)
 {
-    SDL_Surface *surface = IMG_Load(img->path);
-    if (surface) {
-        // We blit to a new buffer to ensure the color order and depth are correct
-        img->buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, 
-            surface->w, surface->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-        SDL_BlitSurface(surface, NULL, img->buffer, NULL);
+    int x, y;
+
+    while (factor[0] > 1 || factor[1] > 1) {
+        int fx = factor[0] > 1 ? 2 : 1;
+        int fy = factor[1] > 1 ? 2 : 1;
+        SDL_Surface *reduced = SDL_CreateRGBSurface(SDL_SWSURFACE,
+            surface->w/fx, surface->h/fy, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+        if (!reduced) break;
+
+        for (y = 0; y < reduced->h; y++) {
+            Uint32 *out = (Uint32 *)((Uint8 *)reduced->pixels + y*reduced->pitch);
+            Uint32 *top = (Uint32 *)((Uint8 *)surface->pixels + y*fy*surface->pitch);
+            Uint32 *bottom = (Uint32 *)((Uint8 *)top + (fy - 1)*surface->pitch);
+            if (fx == 2) {
+                for (x = 0; x < reduced->w; x++) {
+                    out[x] = AVERAGE(AVERAGE(top[2*x], top[2*x+1]),
+                                     AVERAGE(bottom[2*x], bottom[2*x+1]));
+                }
+            } else {
+                for (x = 0; x < reduced->w; x++) {
+                    out[x] = AVERAGE(top[x], bottom[x]);
+                }
+            }
+        }
+
         SDL_FreeSurface(surface);
+        surface = reduced;
+        factor[0] /= fx;
+        factor[1] /= fy;
+    }
+
+    return surface;
+}
+
+static int is_jpeg(const char *path)
+{
+    unsigned char magic[2] = {0, 0};
+    FILE *fp = fopen(path, "rb");
+    if (fp) {
+        if (fread(magic, 1, 2, fp) != 2) magic[0] = 0;
+        fclose(fp);
+    }
+    return magic[0] == 0xFF && magic[1] == 0xD8;
+}
+
+// Load any image as 32 bit ARGB, reduced to what the limits say the globe
+// can display
+SDL_Surface *sosg_image_load_surface(const char *path, sosg_limits_p limits)
+{
+    SDL_Surface *buffer = NULL;
+    int factor[2] = {1, 1};
+
+    if (is_jpeg(path)) buffer = load_jpeg(path, limits, factor);
+
+    if (!buffer) {
+        SDL_Surface *surface = IMG_Load(path);
+        if (surface) {
+            // We blit the latitude band to a new buffer to ensure the color
+            // order and depth are correct
+            int rows[2];
+            SDL_Rect band;
+            sosg_warp_band_rows(limits, surface->h, rows);
+            band.x = 0;
+            band.y = rows[0];
+            band.w = surface->w;
+            band.h = rows[1];
+            buffer = SDL_CreateRGBSurface(SDL_SWSURFACE,
+                surface->w, rows[1], 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+            // Copy the alpha channel rather than blending with it, so images
+            // can be layered over others
+            SDL_SetAlpha(surface, 0, SDL_ALPHA_OPAQUE);
+            if (buffer) SDL_BlitSurface(surface, &band, buffer, NULL);
+            if (buffer) sosg_warp_reduction(limits, surface->w, surface->h, factor);
+            SDL_FreeSurface(surface);
+        } else {
+            fprintf(stderr, "Warning: Could not load image %s\n", path);
+        }
+    }
+
+    if (buffer) buffer = reduce_surface(buffer, factor);
+
+    return buffer;
+}
+
+// Cut an already decoded frame down to the latitude band
+static SDL_Surface *crop_surface(SDL_Surface *surface, sosg_limits_p limits)
+{
+    SDL_Surface *cropped;
+    int rows[2];
+    int y;
+
+    sosg_warp_band_rows(limits, surface->h, rows);
+    if (rows[1] == surface->h) return surface;
+
+    Uint8 *pixels = (Uint8 *)surface->pixels + rows[0]*surface->pitch;
+    if (surface->flags & SDL_PREALLOC) {
+        // The pixels belong to someone else, so just point into the band
+        cropped = SDL_CreateRGBSurfaceFrom(pixels, surface->w, rows[1], 32,
+            surface->pitch, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+    } else {
+        cropped = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w, rows[1], 32,
+            0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+        for (y = 0; cropped && y < rows[1]; y++) {
+            memcpy((Uint8 *)cropped->pixels + y*cropped->pitch,
+                pixels + y*surface->pitch, surface->w*4);
+        }
+    }
+    if (!cropped) return surface;
+
+    SDL_FreeSurface(surface);
+    return cropped;
+}
+
+static SDL_Surface *load_image(sosg_image_p images, int index)
+{
+    // Packed archives are already decoded, so this is close to free
+    if (images->archive) {
+        SDL_Surface *frame = sosg_archive_get_frame(images->archive, index);
+        return frame ? crop_surface(frame, &images->limits) : NULL;
+    }
+
+    return sosg_image_load_surface(images->images[index]->path, &images->limits);
+}
+
+// How far an image is from the current one, wrapping around the slideshow
+static int image_distance(sosg_image_p images, int i)
+{
+    int ahead = (i - images->index + images->num_images) % images->num_images;
+    int behind = images->num_images - ahead;
+    return ahead < behind ? ahead : behind;
+}
+
+// How many steps of playback in a direction until an image comes up, or
+// num_images if it never will
+static int image_steps(sosg_image_p images, int i, int direction)
+{
+    int n = images->num_images;
+    int index = images->index;
+
+    switch (images->playback) {
+        case IMAGE_PINGPONG:
+            // Out to the end and back again
+            if (direction > 0) return i >= index ? i - index : 2*(n - 1) - index - i;
+            return i <= index ? index - i : index + i;
+        case IMAGE_ONCE:
+            return (i - index)*direction >= 0 ? (i - index)*direction : n;
+        default:
+            return ((i - index)*direction + n) % n;
     }
 }
 
-// TODO: keep the thread running and free images far from the current index
-//       to allow loading giant data sets
+// Order the images by how soon they will be needed, or -1 for those outside
+// of the window.  During playback, the window is nearly all ahead of the
+// current image, in the direction of play.
+static int image_rank(sosg_image_p images, int i, int window)
+{
+    if (images->fps <= 0.0) {
+        int distance = image_distance(images, i);
+        return distance <= window ? distance : -1;
+    }
+
+    int behind = 2*window < PLAY_BEHIND ? 2*window : PLAY_BEHIND;
+    int ahead = 2*window - behind;
+    int steps = image_steps(images, i, images->direction);
+    if (steps <= ahead) return steps;
+    steps = image_steps(images, i, -images->direction);
+    if (steps <= behind) return ahead + steps;
+    return -1;
+}
+
+// Warn once if the cache can't hold enough images ahead to cover the time
+// they take to decode at this speed
+static void image_check_lead(sosg_image_p images, int window)
+{
+    if (images->lead_warned || images->fps <= 0.0 || images->decode_ms <= 0.0) return;
+
+    int ahead = 2*window - PLAY_BEHIND;
+    int lead = images->decode_ms*images->fps/(1000.0*images->num_threads) + 1;
+    if (ahead < lead && ahead < images->num_images - 1) {
+        fprintf(stderr, "Warning: The image cache holds %d images ahead, but %.1f fps "
+            "needs %d, so raise -m\n", ahead < 0 ? 0 : ahead, images->fps, lead);
+        images->lead_warned = 1;
+    }
+}
+
+// Free the images that fell out of the window around the current index and
+// return the closest one that still needs to be loaded, or -1 if the window
+// is full.  Must be called with the lock held.
+static int sosg_image_next(sosg_image_p images)
+{
+    int i;
+    int next = -1;
+    int next_rank = 0;
+
+    // Size the window from the cache budget, always keeping the current image
+    int window = images->num_images;
+    if (images->frame_size > 0) {
+        // in size_t, since caches of gigabytes are the point
+        size_t frames = images->cache_size/images->frame_size;
+        if (frames < 2*(size_t)images->num_images + 1)
+            window = frames ? (frames - 1)/2 : 0;
+        image_check_lead(images, window);
+    }
+
+    for (i = 0; i < images->num_images; i++) {
+        img_p img = images->images[i];
+        int rank = image_rank(images, i, window);
+
+        if (rank < 0) {
+            // Never free the image that was last handed out for display
+            if (img->state == IMG_READY && i != images->shown) {
+                images->cache_used -= img->buffer->pitch*img->buffer->h;
+                images->num_loaded--;
+                SDL_FreeSurface(img->buffer);
+                img->buffer = NULL;
+                img->state = IMG_EMPTY;
+            }
+        } else if (img->state == IMG_EMPTY && (next < 0 || rank < next_rank)) {
+            next = i;
+            next_rank = rank;
+        }
+    }
+
+    return next;
+}
+
+// Keep the window around the current index loaded as it moves, which allows
+// data sets far larger than memory.  Several of these run at once, each
+// decoding the closest image nobody else has claimed.
 static int sosg_image_load(void *data)
 {
     sosg_image_p images = (sosg_image_p)data;
-    int i;
-    
-    // Load all of the remaining images
-    for (i = PRELOAD_IMAGES; i < images->num_images; i++) {
-        // Stop early if we're exiting
-        if (!images->running) break;
-        load_image(images->images[i]);
-        images->num_loaded++;
-    }
-    
+
+    SDL_mutexP(images->lock);
+    while (images->running) {
+        int i = sosg_image_next(images);
+        if (i < 0) {
+            // Nothing to do until the index moves
+            SDL_CondWait(images->wake, images->lock);
+            continue;
+        }
+
+        img_p img = images->images[i];
+        img->state = IMG_LOADING;
+        SDL_mutexV(images->lock);
+
+        Uint32 start = SDL_GetTicks();
+        SDL_Surface *buffer = load_image(images, i);
+        float ms = SDL_GetTicks() - start;
+
+        SDL_mutexP(images->lock);
+        // Keep a running average for the playback lead
+        images->decode_ms = images->decode_ms > 0.0 ? 0.9*images->decode_ms + 0.1*ms : ms;
+        img->buffer = buffer;
+        img->state = buffer ? IMG_READY : IMG_FAILED;
+        if (buffer) {
+            int size = buffer->pitch*buffer->h;
+            if (!images->frame_size) images->frame_size = size;
+            images->cache_used += size;
+            images->num_loaded++;
+            images->decoded++;
+            // Show it if the index arrived here before the image did
+            if (i == images->index) images->updated = 1;
+        } else {
+            images->failed++;
+        }
+        SDL_CondBroadcast(images->loaded);
+        if (i == images->index) sosg_source_wake(images->ready);
+    }
+    SDL_mutexV(images->lock);
+
     return 0;
 }
 
-sosg_image_p sosg_image_init(int num_paths, char *paths[])
+sosg_image_p sosg_image_init(int num_paths, char *paths[], int cache_mb, sosg_limits_p limits,
+    sosg_wake_p wake)
 {
     int i;
     sosg_image_p images = calloc(1, sizeof(sosg_image_t));
     if (images) {
+        // A single packed archive stands in for a list of images
+        if (num_paths == 1 && sosg_archive_check(paths[0])) {
+            images->archive = sosg_archive_open(paths[0]);
+            if (!images->archive || !sosg_archive_num_frames(images->archive)) {
+                sosg_image_destroy(images);
+                return NULL;
+            }
+            num_paths = sosg_archive_num_frames(images->archive);
+        }
+
         // Allocate space with the assumption that all the paths are valid
         images->images = calloc(num_paths, sizeof(img_p));
         images->num_images = num_paths;
-        
+        images->cache_size = (size_t)cache_mb << 20;
+        if (limits) images->limits = *limits;
+        images->ready = wake;
+        images->lock = SDL_CreateMutex();
+        images->wake = SDL_CreateCond();
+        images->loaded = SDL_CreateCond();
+
         // Copy the file paths for each images to load
-        // TODO: check if the files actually are valid
         for (i = 0; i < images->num_images; i++) {
             images->images[i] = calloc(1, sizeof(img_t));
-            images->images[i]->path = strdup(paths[i]);
-        }
-        
-        // Load in a few images at the start
-        int preload = images->num_images > PRELOAD_IMAGES ? PRELOAD_IMAGES : images->num_images;
-        for (i = 0; i < preload; i++) {
-            load_image(images->images[i]);
-            images->num_loaded++;
-        }
-        
-        // If we still have more images left, load them in a new thread
-        if (images->num_images > PRELOAD_IMAGES) {
-            images->running = 1;
-            images->load_thread = SDL_CreateThread(sosg_image_load, images);
+            if (!images->archive) images->images[i]->path = strdup(paths[i]);
         }
 
         images->index = 0;
         images->updated = 1;
+
+        // Decode on every core, but there is no point in more threads than images
+        images->num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (images->num_threads < 1) images->num_threads = 1;
+        if (images->num_threads > MAX_LOAD_THREADS) images->num_threads = MAX_LOAD_THREADS;
+        if (images->num_threads > images->num_images) images->num_threads = images->num_images;
+
+        images->running = 1;
+        for (i = 0; i < images->num_threads; i++) {
+            images->load_threads[i] = SDL_CreateThread(sosg_image_load, images);
+        }
+
+        // Only wait for the first image so the resolution is known
+        img_p first = images->images[0];
+        SDL_mutexP(images->lock);
+        while (first->state == IMG_EMPTY || first->state == IMG_LOADING) {
+            SDL_CondWait(images->loaded, images->lock);
+        }
+        if (first->buffer) {
+            images->resolution[0] = first->buffer->w;
+            images->resolution[1] = first->buffer->h;
+        }
+        SDL_mutexV(images->lock);
     }
-    
+
     return images;
 }
 
@@ -89,9 +488,14 @@ void sosg_image_destroy(sosg_image_p images)
 {
     int i;
     if (images) {
+        SDL_mutexP(images->lock);
         images->running = 0;
-        if (images->load_thread) SDL_WaitThread(images->load_thread, NULL);
-    
+        SDL_CondBroadcast(images->wake);
+        SDL_mutexV(images->lock);
+        for (i = 0; i < images->num_threads; i++) {
+            if (images->load_threads[i]) SDL_WaitThread(images->load_threads[i], NULL);
+        }
+
         if (images->images) {
             for (i = 0; i < images->num_images; i++) {
                 if (images->images[i]) {
@@ -102,15 +506,36 @@ void sosg_image_destroy(sosg_image_p images)
             }
             free(images->images);
         }
+        if (images->lock) SDL_DestroyMutex(images->lock);
+        if (images->wake) SDL_DestroyCond(images->wake);
+        if (images->loaded) SDL_DestroyCond(images->loaded);
+        // Frames may point into the archive, so it goes after they are freed
+        if (images->archive) sosg_archive_close(images->archive);
         free(images);
     }
 }
 
 void sosg_image_get_resolution(sosg_image_p images, int *resolution)
 {
-    if (resolution && images && images->images[images->index]->buffer) {
-        resolution[0] = images->images[images->index]->buffer->w;
-        resolution[1] = images->images[images->index]->buffer->h;
+    // This is the resolution of the image most recently passed for display
+    if (resolution && images && images->resolution[0]) {
+        resolution[0] = images->resolution[0];
+        resolution[1] = images->resolution[1];
+    }
+}
+
+void sosg_image_get_stats(sosg_image_p images, sosg_source_stats_p stats)
+{
+    if (images && stats) {
+        memset(stats, 0, sizeof(sosg_source_stats_t));
+        SDL_mutexP(images->lock);
+        stats->decoded = images->decoded;
+        stats->presented = images->presented;
+        // An image that fails to decode is skipped over
+        stats->dropped = images->failed;
+        stats->late = images->late;
+        stats->late_max = images->late_max;
+        SDL_mutexV(images->lock);
     }
 }
 
@@ -118,25 +543,203 @@ void sosg_image_set_index(sosg_image_p images, int index)
 {
     if (images) {
         // Act on the difference between the last input and the current one
-        // to avoid some weirdness while the images are still loading
+        // so the index stays relative to where the slideshow is
         int i = index - images->last_index;
         images->last_index = index;
-        int new_index = images->index + i;
 
-        // Only use images that have completed loading
-        int loaded = images->num_loaded;
-        while (new_index < 0) new_index += loaded;
-        new_index = new_index % loaded;
+        SDL_mutexP(images->lock);
+        int new_index = images->index + i;
+        while (new_index < 0) new_index += images->num_images;
+        new_index = new_index % images->num_images;
         images->index = new_index;
         images->updated = 1;
+        // Playback carries on from here after a full frame
+        if (images->fps > 0.0) images->due = SDL_GetTicks() + 1000.0/images->fps;
+        // Let the loaders slide the window over
+        SDL_CondBroadcast(images->wake);
+        SDL_mutexV(images->lock);
     }
 }
 
+// Play the images as a time-lapse at fps, backwards if it is negative, or
+// stop playing at 0
+void sosg_image_play(sosg_image_p images, float fps, int playback)
+{
+    if (images) {
+        SDL_mutexP(images->lock);
+        images->fps = fps < 0.0 ? -fps : fps;
+        images->direction = fps < 0.0 ? -1 : 1;
+        images->playback = playback;
+        images->due = SDL_GetTicks() + (fps ? 1000.0/images->fps : 0);
+        SDL_CondBroadcast(images->wake);
+        SDL_mutexV(images->lock);
+    }
+}
+
+// Move to the next image in the direction of play, turning around or
+// stopping at the ends.  Returns 0 once playback is over.  Must be called
+// with the lock held.
+static int image_step(sosg_image_p images)
+{
+    int n = images->num_images;
+    int next = images->index + images->direction;
+
+    if (next < 0 || next >= n) {
+        switch (images->playback) {
+            case IMAGE_PINGPONG:
+                images->direction = -images->direction;
+                next = n > 1 ? images->index + images->direction : images->index;
+                break;
+            case IMAGE_ONCE:
+                images->fps = 0.0;
+                return 0;
+            default:
+                next = (next + n) % n;
+                break;
+        }
+    }
+
+    images->index = next;
+    images->updated = 1;
+    images->stepped = SDL_GetTicks();
+    SDL_CondBroadcast(images->wake);
+    return 1;
+}
+
+// Step once the current image is up and the next is due.  The sequence holds
+// while an image is still loading, so none are skipped, but an image that
+// failed to load is.  Must be called with the lock held.
+static void image_play(sosg_image_p images)
+{
+    if (images->updated) {
+        if (images->images[images->index]->state == IMG_FAILED) image_step(images);
+        return;
+    }
+    Uint32 now = SDL_GetTicks();
+    if ((Sint32)(now - images->due) < 0) return;
+
+    if (!image_step(images)) return;
+    images->due += 1000.0/images->fps;
+    // Don't race to catch up after falling behind
+    if ((Sint32)(now - images->due) > 0) images->due = now + 1000.0/images->fps;
+}
+
+// Note how long past its time an image went up, and pace the rest from then
+static void image_late(sosg_image_p images)
+{
+    Uint32 now = SDL_GetTicks();
+    int late = now - images->stepped;
+    if (late <= 0) return;
+
+    images->late++;
+    if (late > images->late_max) images->late_max = late;
+    images->due = now + 1000.0/images->fps;
+
+    // Only a stall of a whole frame or more is visible
+    if (late >= 1000.0/images->fps && now - images->late_warned > LATE_WARNING) {
+        fprintf(stderr, "Warning: Image %d was %d ms late, %d late so far\n",
+            images->index, late, images->late);
+        images->late_warned = now;
+    }
+}
+
+// How long until playback steps to the next image.  An image still loading
+// wakes the media thread when it is done, and one that failed is skipped
+// straight away.
+int sosg_image_due(sosg_image_p images)
+{
+    int due = -1;
+    if (!images) return -1;
+
+    SDL_mutexP(images->lock);
+    if (images->updated) {
+        if (images->images[images->index]->state == IMG_FAILED) due = 0;
+    } else if (images->fps > 0.0) {
+        due = (Sint32)(images->due - SDL_GetTicks());
+        if (due < 0) due = 0;
+    }
+    SDL_mutexV(images->lock);
+
+    return due;
+}
+
 SDL_Surface *sosg_image_update(sosg_image_p images)
 {
-    // Only pass a surface if we switched to a new image
-    if (!images || !images->num_loaded || !images->updated) return NULL;
-    
-    images->updated = 0;
-    return images->images[images->index]->buffer;
+    SDL_Surface *buffer = NULL;
+    if (!images) return NULL;
+
+    // Only pass a surface if we switched to a new image and it is loaded
+    SDL_mutexP(images->lock);
+    if (images->fps > 0.0) image_play(images);
+    img_p img = images->images[images->index];
+    if (images->updated && img->state == IMG_READY) {
+        if (images->fps > 0.0 && images->stepped) image_late(images);
+        images->stepped = 0;
+        images->updated = 0;
+        images->shown = images->index;
+        images->presented++;
+        images->resolution[0] = img->buffer->w;
+        images->resolution[1] = img->buffer->h;
+        buffer = img->buffer;
+    }
+    SDL_mutexV(images->lock);
+
+    return buffer;
+}
+
+static void *image_init(sosg_source_config_p config)
+{
+    // The remaining args are assumed to be filenames
+    sosg_image_p images = sosg_image_init(config->num_paths, config->paths,
+        config->cache_mb, config->limits, config->wake);
+    if (config->fps) sosg_image_play(images, config->fps, config->playback);
+    return images;
+}
+
+static void image_destroy(void *source)
+{
+    sosg_image_destroy(source);
+}
+
+static void image_seek(void *source, int index)
+{
+    sosg_image_set_index(source, index);
+}
+
+static int image_acquire_frame(void *source, sosg_frame_p frame)
+{
+    sosg_image_p images = source;
+    SDL_Surface *surface = sosg_image_update(images);
+    // The loaders never free the image last handed out, so it stays valid
+    // until the next one is acquired
+    return sosg_frame_from_surface(frame, surface, surface ? images->presented : 0);
 }
+
+static void image_get_resolution(void *source, int *resolution)
+{
+    sosg_image_get_resolution(source, resolution);
+}
+
+static void image_get_stats(void *source, sosg_source_stats_p stats)
+{
+    sosg_image_get_stats(source, stats);
+}
+
+static int image_due(void *source)
+{
+    return sosg_image_due(source);
+}
+
+sosg_source_t sosg_image_source = {
+    "Images",
+    image_init,
+    image_destroy,
+    image_seek,
+    NULL,
+    image_acquire_frame,
+    NULL,
+    image_get_resolution,
+    image_get_stats,
+    NULL,
+    image_due
+};
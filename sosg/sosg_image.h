@@ -3,13 +3,28 @@
 
 #include "SDL.h"
 #include "SDL_image.h"
+#include "sosg_warp.h"
+#include "sosg_source.h"
 
 typedef struct sosg_image_struct *sosg_image_p;
 
-sosg_image_p sosg_image_init(int num_paths, char *paths[]);
+enum sosg_image_playback {
+    IMAGE_LOOP,
+    IMAGE_PINGPONG,
+    IMAGE_ONCE
+};
+
+extern sosg_source_t sosg_image_source;
+
+sosg_image_p sosg_image_init(int num_paths, char *paths[], int cache_mb, sosg_limits_p limits,
+    sosg_wake_p wake);
 void sosg_image_destroy(sosg_image_p images);
 void sosg_image_get_resolution(sosg_image_p images, int *resolution);
+void sosg_image_get_stats(sosg_image_p images, sosg_source_stats_p stats);
 void sosg_image_set_index(sosg_image_p images, int index);
+void sosg_image_play(sosg_image_p images, float fps, int playback);
+int sosg_image_due(sosg_image_p images);
 SDL_Surface *sosg_image_update(sosg_image_p images);
+SDL_Surface *sosg_image_load_surface(const char *path, sosg_limits_p limits);
 
 #endif /* _SOSG_IMAGE_H_ */
@@ -0,0 +1,149 @@
+/* Science on a Snow Globe dataset packer
+ *
+ * Decodes a list of images once and writes them out as a packed archive that
+ * sosg can memory map and display without decoding anything.
+ */
+
+#include "SDL.h"
+#include "SDL_image.h"
+#include "sosg_archive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <lz4.h>
+
+static void usage(void)
+{
+    printf("Usage: sosg-pack [OPTION] OUTPUT IMAGES\n\n");
+    printf("Packs images into a pre-decoded archive for sosg -i.\n\n");
+    printf("        -z     Compress frames with LZ4\n\n");
+}
+
+static int write_frame(FILE *fp, sosg_archive_frame_p frame, SDL_Surface *surface, int compress)
+{
+    int size = surface->pitch*surface->h;
+    char *out = surface->pixels;
+    char *compressed = NULL;
+    
+    // Start every frame on a page so it can be mapped and used in place
+    long offset = ftell(fp);
+    offset = (offset + SOSG_ARCHIVE_ALIGN - 1)/SOSG_ARCHIVE_ALIGN*SOSG_ARCHIVE_ALIGN;
+    if (fseek(fp, offset, SEEK_SET)) return -1;
+    
+    frame->offset = offset;
+    frame->flags = 0;
+    frame->w = surface->w;
+    frame->h = surface->h;
+    frame->pitch = surface->pitch;
+    
+    if (compress) {
+        compressed = malloc(LZ4_compressBound(size));
+        if (!compressed) return -1;
+        int compressed_size = LZ4_compress_default(surface->pixels, compressed,
+            size, LZ4_compressBound(size));
+        // Only keep the compressed frame if it actually saved space
+        if (compressed_size > 0 && compressed_size < size) {
+            out = compressed;
+            size = compressed_size;
+            frame->flags |= SOSG_ARCHIVE_LZ4;
+        }
+    }
+    
+    frame->size = size;
+    int written = fwrite(out, size, 1, fp);
+    if (compressed) free(compressed);
+    
+    return written == 1 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i;
+    int compress = 0;
+    
+    while ((c = getopt(argc, argv, "z")) != -1) {
+        switch (c) {
+            case 'z':
+                compress = 1;
+                break;
+            case '?':
+            default:
+                usage();
+                return 1;
+        }
+    }
+    
+    if (argc - optind < 2) {
+        usage();
+        fprintf(stderr, "Error: Missing output or image paths.\n");
+        return 1;
+    }
+    
+    char *output = argv[optind];
+    int num_frames = argc - optind - 1;
+    sosg_archive_header_t header;
+    sosg_archive_frame_p frames = calloc(num_frames, sizeof(sosg_archive_frame_t));
+    if (!frames) {
+        fprintf(stderr, "Error: Could not allocate frame table\n");
+        return 1;
+    }
+    
+    FILE *fp = fopen(output, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not open %s for writing\n", output);
+        free(frames);
+        return 1;
+    }
+    
+    // Reserve space for the header and frame table, filled in at the end
+    memset(&header, 0, sizeof(header));
+    fseek(fp, sizeof(header) + num_frames*sizeof(sosg_archive_frame_t), SEEK_SET);
+    
+    for (i = 0; i < num_frames; i++) {
+        char *path = argv[optind + 1 + i];
+        SDL_Surface *surface = IMG_Load(path);
+        if (!surface) {
+            fprintf(stderr, "Error: Could not load image %s\n", path);
+            break;
+        }
+        
+        // Store the frames in the same 32 bit layout sosg_image uses
+        SDL_Surface *buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w,
+            surface->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+        SDL_BlitSurface(surface, NULL, buffer, NULL);
+        SDL_FreeSurface(surface);
+        
+        int failed = write_frame(fp, frames + i, buffer, compress);
+        SDL_FreeSurface(buffer);
+        if (failed) {
+            fprintf(stderr, "Error: Could not write %s to %s\n", path, output);
+            break;
+        }
+        
+        printf("%d/%d %s %dx%d %u bytes\n", i + 1, num_frames, path,
+            frames[i].w, frames[i].h, frames[i].size);
+    }
+    
+    if (i == num_frames) {
+        memcpy(header.magic, SOSG_ARCHIVE_MAGIC, sizeof(header.magic));
+        header.version = SOSG_ARCHIVE_VERSION;
+        header.num_frames = num_frames;
+        fseek(fp, 0, SEEK_SET);
+        if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+            fwrite(frames, sizeof(sosg_archive_frame_t), num_frames, fp) != num_frames) {
+            fprintf(stderr, "Error: Could not write the frame table to %s\n", output);
+            i = 0;
+        }
+    }
+    
+    fclose(fp);
+    free(frames);
+    
+    if (i != num_frames) {
+        remove(output);
+        return 1;
+    }
+    
+    return 0;
+}
@@ -1,34 +1,103 @@
 #include "sosg_predict.h"
+#include "sosg_image.h"
+#include "sosg_sgp4.h"
 #include "SDL_net.h"
-#include "SDL_gfxPrimitives.h"
 #include "SDL_image.h"
 #include "SDL_ttf.h"
+#include "SDL_opengl.h"
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
+#include <sys/time.h>
 
 #define PREDICT_CLIENT_INTERVAL 1000
+// Propagating locally is cheap enough to do often enough for smooth motion
+#define PREDICT_LOCAL_INTERVAL 40
 #define PREDICT_SERVER_NAME "localhost" // TODO: support passing in the address
 #define PREDICT_SERVER_PORT 1210
 #define PREDICT_SERVER_MTU 1500
 #define PREDICT_SERVER_TIMEOUT 5000
+// Each satellite's request is sent again if it goes this long unanswered
+#define PREDICT_REQUEST_TIMEOUT 500
+#define PREDICT_REQUEST_TRIES 3
+#define PREDICT_POLL 10
+// Labels are rendered once into an atlas this big, and satellites past what
+// fits go without.  Sprites are a pixel apart so filtering never bleeds.
+#define PREDICT_ATLAS_SIZE 2048
+#define PREDICT_ATLAS_PAD 1
 
 #define PREDICT_VISIBLE 0x00FF0066
 #define PREDICT_HIDDEN 0xFF000066
 
-typedef struct satellite_struct {
-    char *name;
-    SDL_Surface *name_surf;
-    float longitude;
-    float latitude;
-    char visibility;
+// Every satellite, with one array per value so the table can grow to whole
+// catalogs and each pass over it only touches what it needs
+typedef struct sats_struct {
+    int count;
+    int size;
+    char **name;
+    float *longitude;
+    float *latitude;
+    char *visibility;
+    float *x;
+    float *y;
+    int *path_x;        // The pixel its track was last drawn to
+    int *path_y;
+    char *located;
+    int *label;         // The name in the atlas, or -1 for none
+    // State of the request in flight for the current refresh
+    char *pending;
+    int *tries;
+    Uint32 *sent;
+} sats_t, *sats_p;
+
+// The icon, the highlight behind visible satellites and every label, packed
+// in rows into one surface
+typedef struct atlas_struct {
+    SDL_Surface *surface;
+    SDL_Rect *rects;
+    int count;
+    int size;
     int x;
     int y;
-} sat, *sat_p;
+    int row;            // Height of the row being filled
+    int icon;
+    int highlight;
+} atlas_t, *atlas_p;
+
+// A corner of a sprite or an end of a track, in map pixels
+typedef struct vertex_struct {
+    float x;
+    float y;
+    float u;
+    float v;
+    Uint8 color[4];
+} vertex_t, *vertex_p;
+
+typedef struct verts_struct {
+    int count;
+    int size;
+    vertex_p v;
+} verts_t, *verts_p;
+
+enum predict_target {
+    PREDICT_PATH,       // The map with every track drawn over it so far
+    PREDICT_FRAME,      // That with the satellites over it, handed over
+    PREDICT_TARGETS
+};
+
+// What the render thread draws with, only touched there
+typedef struct gpu_struct {
+    GLuint textures[PREDICT_TARGETS];
+    GLuint fbo[PREDICT_TARGETS];
+    GLuint atlas;
+    int failed;
+} gpu_t, *gpu_p;
 
 typedef struct sosg_predict_struct {
     char *path;
-    SDL_Surface *buffer;
-    SDL_Surface *update_surf;
+    // The map, until the render thread takes it onto the GPU
+    SDL_Surface *map;
+    int size[2];
     TTF_Font *font;
     SDL_Thread *client_thread;
     SDL_mutex *update_lock;
@@ -36,23 +105,39 @@ typedef struct sosg_predict_struct {
     SDL_cond *client_timeout;
     int running;
     int should_update;
+    int presented;
+    int interval;
+    float band[2];
+    sosg_wake_p ready;
     
     // TODO: split the predict client thread into a separate file/struct
-    sat *sats;
-    int num_sats;
-    SDL_Surface *path_surf;
+    sats_t sats;
+    atlas_t atlas;
+    // Propagated here from TLEs instead of asking a PREDICT server
+    sosg_sgp4_p sgp4;
     SDL_Surface *sat_icon;
+    // Only positions and tracks go to the GPU.  lines holds the track
+    // segments from this refresh in the client thread.  The first of sprites
+    // and tracks is the latest refresh, under the update lock, and the second
+    // is what was handed over with the frame for the render thread to draw.
+    verts_t lines;
+    verts_t sprites[2];
+    verts_t tracks[2];
+    gpu_t gpu;
     SDLNet_SocketSet sockset;
     UDPsocket sock;
     UDPpacket *packet;
     IPaddress server;
+    // Totals for the statistics, under the update lock
+    int refreshes;
+    int refresh_last;
+    int refresh_max;
+    int requests;
+    int replies;
 } sosg_predict_t;
 
-static int sosg_predict_message(sosg_predict_p predict, char *out, int outlen, char *in, int *inlen)
+static int sosg_predict_send(sosg_predict_p predict, char *out, int outlen)
 {
-    int received = 0;
-    int timeout = PREDICT_SERVER_TIMEOUT;
-    
     // copy the outgoing data into the packet
     memcpy(predict->packet->data, out, outlen);
     predict->packet->len = outlen;
@@ -64,6 +149,16 @@ static int sosg_predict_message(sosg_predict_p predict, char *out, int outlen, c
         return -1;
     }
     
+    return 0;
+}
+
+static int sosg_predict_message(sosg_predict_p predict, char *out, int outlen, char *in, int *inlen)
+{
+    int received = 0;
+    int timeout = PREDICT_SERVER_TIMEOUT;
+    
+    if (sosg_predict_send(predict, out, outlen)) return -1;
+    
     // quit if we get the packet, recv fails, we time out, or the app is exiting
     while ((received != 1) && (timeout > 0) && predict->running) {
         SDLNet_CheckSockets(predict->sockset, 100);
@@ -121,137 +216,550 @@ static int sosg_predict_client_init(sosg_predict_p predict)
             PREDICT_SERVER_NAME, PREDICT_SERVER_PORT, SDLNet_GetError());
         return -1;
     }
+        
+    return 0;
+}
+
+static int sosg_predict_grow(void **array, int size, size_t item)
+{
+    void *grown = realloc(*array, size*item);
+    if (!grown) return -1;
+    *array = grown;
+    return 0;
+}
+
+// Add a satellite to the end of the table, doubling it when it is full
+static int sosg_predict_add_sat(sosg_predict_p predict, const char *name)
+{
+    sats_p sats = &predict->sats;
     
-    // PREDICT supports a maximum of 24 satellites, so we will too
-    predict->sats = calloc(24, sizeof(sat));
-    if (!predict->sats) {
-        fprintf(stderr, "Error: Could not allocate satellite array\n");
-        return -1;
+    if (sats->count == sats->size) {
+        int size = sats->size ? sats->size*2 : 32;
+        if (sosg_predict_grow((void **)&sats->name, size, sizeof(char *))
+         || sosg_predict_grow((void **)&sats->longitude, size, sizeof(float))
+         || sosg_predict_grow((void **)&sats->latitude, size, sizeof(float))
+         || sosg_predict_grow((void **)&sats->visibility, size, sizeof(char))
+         || sosg_predict_grow((void **)&sats->x, size, sizeof(float))
+         || sosg_predict_grow((void **)&sats->y, size, sizeof(float))
+         || sosg_predict_grow((void **)&sats->path_x, size, sizeof(int))
+         || sosg_predict_grow((void **)&sats->path_y, size, sizeof(int))
+         || sosg_predict_grow((void **)&sats->located, size, sizeof(char))
+         || sosg_predict_grow((void **)&sats->label, size, sizeof(int))
+         || sosg_predict_grow((void **)&sats->pending, size, sizeof(char))
+         || sosg_predict_grow((void **)&sats->tries, size, sizeof(int))
+         || sosg_predict_grow((void **)&sats->sent, size, sizeof(Uint32))) {
+            fprintf(stderr, "Error: Could not grow satellite table to %d\n", size);
+            return -1;
+        }
+        sats->size = size;
     }
+    
+    int i = sats->count++;
+    sats->name[i] = strdup(name);
+    sats->longitude[i] = 0.0;
+    sats->latitude[i] = 0.0;
+    sats->visibility[i] = '\0';
+    sats->x[i] = 0.0;
+    sats->y[i] = 0.0;
+    sats->path_x[i] = 0;
+    sats->path_y[i] = 0;
+    sats->located[i] = 0;
+    sats->label[i] = -1;
+    sats->pending[i] = 0;
+    sats->tries[i] = 0;
+    sats->sent[i] = 0;
+    
+    return 0;
+}
+
+static void sosg_predict_free_sats(sosg_predict_p predict)
+{
+    sats_p sats = &predict->sats;
+    int i = 0;
+    
+    for (i = 0; i < sats->count; i++) {
+        if (sats->name[i]) free(sats->name[i]);
+    }
+    if (sats->name) free(sats->name);
+    if (sats->longitude) free(sats->longitude);
+    if (sats->latitude) free(sats->latitude);
+    if (sats->visibility) free(sats->visibility);
+    if (sats->x) free(sats->x);
+    if (sats->y) free(sats->y);
+    if (sats->path_x) free(sats->path_x);
+    if (sats->path_y) free(sats->path_y);
+    if (sats->located) free(sats->located);
+    if (sats->label) free(sats->label);
+    if (sats->pending) free(sats->pending);
+    if (sats->tries) free(sats->tries);
+    if (sats->sent) free(sats->sent);
+}
+
+// Pack a sprite into the next free spot in the atlas, returning its index,
+// or -1 once the atlas is full
+static int sosg_predict_atlas_add(sosg_predict_p predict, SDL_Surface *sprite)
+{
+    atlas_p atlas = &predict->atlas;
+    
+    if (!atlas->surface || !sprite || sprite->w > atlas->surface->w) return -1;
+    
+    // start a new row when this one is full
+    if (atlas->x + sprite->w > atlas->surface->w) {
+        atlas->x = 0;
+        atlas->y += atlas->row;
+        atlas->row = 0;
+    }
+    if (atlas->y + sprite->h > atlas->surface->h) return -1;
+    
+    if (atlas->count == atlas->size) {
+        int size = atlas->size ? atlas->size*2 : 32;
+        if (sosg_predict_grow((void **)&atlas->rects, size, sizeof(SDL_Rect))) return -1;
+        atlas->size = size;
+    }
+    
+    SDL_Rect *rect = atlas->rects + atlas->count;
+    rect->x = atlas->x;
+    rect->y = atlas->y;
+    rect->w = sprite->w;
+    rect->h = sprite->h;
+    
+    // copy the alpha channel rather than blending with it
+    SDL_Rect pos = *rect;
+    SDL_SetAlpha(sprite, 0, SDL_ALPHA_OPAQUE);
+    SDL_BlitSurface(sprite, NULL, atlas->surface, &pos);
+    
+    atlas->x += sprite->w + PREDICT_ATLAS_PAD;
+    if (sprite->h + PREDICT_ATLAS_PAD > atlas->row) atlas->row = sprite->h + PREDICT_ATLAS_PAD;
+    
+    return atlas->count++;
+}
+
+// The translucent circle that goes behind visible satellites
+static SDL_Surface *sosg_predict_highlight(int size)
+{
+    int x = 0, y = 0;
+    float r = size/2.0;
+    
+    SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE, size, size, 32,
+        0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+    if (!surface) return NULL;
+    
+    SDL_LockSurface(surface);
+    for (y = 0; y < size; y++) {
+        Uint32 *row = (Uint32 *)((Uint8 *)surface->pixels + y*surface->pitch);
+        for (x = 0; x < size; x++) {
+            float dx = x + 0.5 - r, dy = y + 0.5 - r;
+            // PREDICT_VISIBLE as ARGB
+            row[x] = dx*dx + dy*dy <= r*r ? 0x6600FF00 : 0;
+        }
+    }
+    SDL_UnlockSurface(surface);
+    
+    return surface;
+}
+
+// Render the icon, highlight and every name once, so drawing them later is
+// only copying pixels
+static void sosg_predict_build_atlas(sosg_predict_p predict)
+{
+    atlas_p atlas = &predict->atlas;
+    sats_p sats = &predict->sats;
+    SDL_Color color = {255, 255, 255};
+    int i = 0;
+    
+    atlas->icon = -1;
+    atlas->highlight = -1;
+    atlas->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, PREDICT_ATLAS_SIZE,
+        PREDICT_ATLAS_SIZE, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+    if (!atlas->surface) {
+        fprintf(stderr, "Warning: Could not create the satellite atlas\n");
+        return;
+    }
+    
+    if (predict->sat_icon) {
+        atlas->icon = sosg_predict_atlas_add(predict, predict->sat_icon);
+        SDL_Surface *highlight = sosg_predict_highlight(predict->sat_icon->w);
+        atlas->highlight = sosg_predict_atlas_add(predict, highlight);
+        if (highlight) SDL_FreeSurface(highlight);
+    }
+    
+    for (i = 0; i < sats->count && predict->font; i++) {
+        char name[10];
+        // clip the name if it is long
+        int len = strlen(sats->name[i]);
+        strncpy(name, sats->name[i], 9);
+        if (len > 9) {
+            name[7] = '~';
+            name[8] = sats->name[i][len-1];
+        }
+        name[9] = '\0';
         
+        SDL_Surface *label = TTF_RenderText_Blended(predict->font, name, color);
+        sats->label[i] = sosg_predict_atlas_add(predict, label);
+        if (label) SDL_FreeSurface(label);
+        if (sats->label[i] < 0) {
+            fprintf(stderr, "Warning: Only the first %d of %d satellites fit labels\n",
+                i, sats->count);
+            break;
+        }
+    }
+}
+
+// Make room for one more vertex at the end, doubling the array when it is
+// full.  Returns it, or NULL if it couldn't grow.
+static vertex_p sosg_predict_new_vertex(verts_p verts)
+{
+    if (verts->count == verts->size) {
+        int size = verts->size ? verts->size*2 : 1024;
+        if (sosg_predict_grow((void **)&verts->v, size, sizeof(vertex_t))) {
+            fprintf(stderr, "Error: Could not grow satellite vertices to %d\n", size);
+            return NULL;
+        }
+        verts->size = size;
+    }
+    
+    return verts->v + verts->count++;
+}
+
+static int sosg_predict_add_vertex(verts_p verts, float x, float y, float u, float v,
+    Uint32 color)
+{
+    vertex_p vertex = sosg_predict_new_vertex(verts);
+    if (!vertex) return -1;
+    
+    vertex->x = x;
+    vertex->y = y;
+    vertex->u = u;
+    vertex->v = v;
+    // colors are given as 0xRRGGBBAA
+    vertex->color[0] = color >> 24;
+    vertex->color[1] = color >> 16;
+    vertex->color[2] = color >> 8;
+    vertex->color[3] = color;
+    
     return 0;
 }
 
-static int sosg_predict_update_sat(sosg_predict_p predict, sat_p input)
+// Add a quad showing a sprite from the atlas with its corner at x, y
+static int sosg_predict_add_sprite(verts_p verts, SDL_Rect *rect, float x, float y)
+{
+    float u[2] = {rect->x, rect->x + rect->w}, v[2] = {rect->y, rect->y + rect->h};
+    int i = 0;
+    
+    for (i = 0; i < 2; i++) {
+        u[i] /= PREDICT_ATLAS_SIZE;
+        v[i] /= PREDICT_ATLAS_SIZE;
+    }
+    
+    if (sosg_predict_add_vertex(verts, x, y, u[0], v[0], 0xFFFFFFFF)
+     || sosg_predict_add_vertex(verts, x + rect->w, y, u[1], v[0], 0xFFFFFFFF)
+     || sosg_predict_add_vertex(verts, x + rect->w, y + rect->h, u[1], v[1], 0xFFFFFFFF)
+     || sosg_predict_add_vertex(verts, x, y + rect->h, u[0], v[1], 0xFFFFFFFF))
+        return -1;
+    
+    return 0;
+}
+
+// Add the sprites of one satellite with the icon's corner at x, y
+static int sosg_predict_add_sat_sprites(sosg_predict_p predict, verts_p verts, int i,
+    float x, float y)
+{
+    sats_p sats = &predict->sats;
+    atlas_p atlas = &predict->atlas;
+    SDL_Rect *icon = atlas->rects + atlas->icon;
+    
+    // highlight visible satellites
+    if (sats->visibility[i] == 'V' && atlas->highlight >= 0
+     && sosg_predict_add_sprite(verts, atlas->rects + atlas->highlight, x, y))
+        return -1;
+    if (sosg_predict_add_sprite(verts, icon, x, y)) return -1;
+    // put the name next to the icon
+    if (sats->label[i] >= 0
+     && sosg_predict_add_sprite(verts, atlas->rects + sats->label[i], x + icon->w, y))
+        return -1;
+    
+    return 0;
+}
+
+// Lay out a quad for every sprite of every satellite, in the order they are
+// drawn over each other.  One hanging off either side of the map is laid out
+// again a map width over, right after, so it wraps around in longitude
+// without changing what is drawn over what.
+static void sosg_predict_build_sprites(sosg_predict_p predict, verts_p verts)
+{
+    sats_p sats = &predict->sats;
+    atlas_p atlas = &predict->atlas;
+    float width = predict->size[0];
+    int i = 0;
+    
+    verts->count = 0;
+    if (atlas->icon < 0) return;
+    
+    SDL_Rect *icon = atlas->rects + atlas->icon;
+    for (i = 0; i < sats->count; i++) {
+        if (!sats->located[i]) continue;
+        float x = sats->x[i] - icon->w/2, y = sats->y[i] - icon->h/2;
+        float right = x + icon->w + (sats->label[i] >= 0 ? atlas->rects[sats->label[i]].w : 0);
+        if (sosg_predict_add_sat_sprites(predict, verts, i, x, y)
+         || (x < 0 && sosg_predict_add_sat_sprites(predict, verts, i, x + width, y))
+         || (right > width && sosg_predict_add_sat_sprites(predict, verts, i, x - width, y)))
+            return;
+    }
+}
+
+static int sosg_predict_request(sosg_predict_p predict, int i)
 {
-    char buf[PREDICT_SERVER_MTU];
     char sendbuf[PREDICT_SERVER_MTU];
-    int len = PREDICT_SERVER_MTU;
-    int sendlen = 0;
-
-    sendlen = sprintf(sendbuf, "GET_SAT %s\n", input->name);
-
-    if (!sosg_predict_message(predict, sendbuf, sendlen, buf, &len)) {
-        // since the first line can have spaces in it, we need to start scanning
-        // the string at the second line
-        char *values = strchr(buf, '\n');
-        int matched = 0;
-        if (values) {
-            // we only care about three of the values
-            matched = sscanf(values, "%f %f %*f %*f %*d %*f %*f %*f %*f %*d %c %*f %*f %*f",
-                &input->longitude, &input->latitude, &input->visibility);
+    int sendlen = snprintf(sendbuf, sizeof(sendbuf), "GET_SAT %s\n", predict->sats.name[i]);
+
+    predict->sats.sent[i] = SDL_GetTicks();
+    predict->sats.tries[i]++;
+
+    return sosg_predict_send(predict, sendbuf, sendlen);
+}
+
+// Match a GET_SAT reply to the satellite waiting on it by the name on its
+// first line, and take the position from the rest.  Returns its index, or -1
+static int sosg_predict_parse(sosg_predict_p predict, char *buf)
+{
+    sats_p sats = &predict->sats;
+    int i = 0;
+
+    // since the first line can have spaces in it, we need to start scanning
+    // the string at the second line
+    char *values = strchr(buf, '\n');
+    if (!values) return -1;
+    *values++ = '\0';
+
+    while (i < sats->count && !(sats->pending[i] && !strcmp(sats->name[i], buf))) i++;
+    // A late reply to a request that was already answered or given up on
+    if (i == sats->count) return -1;
+
+    // we only care about three of the values, and keep the last good ones
+    // if the reply is cut short
+    float longitude, latitude;
+    char visibility;
+    int matched = sscanf(values, "%f %f %*f %*f %*d %*f %*f %*f %*f %*d %c %*f %*f %*f",
+        &longitude, &latitude, &visibility);
+    if (matched != 3) {
+        fprintf(stderr, "Warning: Malformed update for %s\n", sats->name[i]);
+        return -1;
+    }
+    sats->longitude[i] = longitude;
+    sats->latitude[i] = latitude;
+    sats->visibility[i] = visibility;
+    
+    return i;
+}
+
+// Add a track segment between pixel centers.  One that is shorter going
+// around the back of the map is split where it crosses the edge.
+static void sosg_predict_add_track(sosg_predict_p predict, float x0, float y0,
+    float x1, float y1, Uint32 color)
+{
+    float width = predict->size[0];
+    float edge = -1.0;
+    
+    if (x1 - x0 > width/2) {
+        // Going west over the left edge, coming back in on the right
+        x1 -= width;
+        edge = 0.0;
+    } else if (x0 - x1 > width/2) {
+        // Going east over the right edge, coming back in on the left
+        x1 += width;
+        edge = width;
+    }
+    if (edge < 0.0) {
+        sosg_predict_add_vertex(&predict->lines, x0, y0, 0.0, 0.0, color);
+        sosg_predict_add_vertex(&predict->lines, x1, y1, 0.0, 0.0, color);
+        return;
+    }
+    
+    float y = y0 + (y1 - y0)*(edge - x0)/(x1 - x0);
+    float other = width - edge;
+    sosg_predict_add_vertex(&predict->lines, x0, y0, 0.0, 0.0, color);
+    sosg_predict_add_vertex(&predict->lines, edge, y, 0.0, 0.0, color);
+    sosg_predict_add_vertex(&predict->lines, other, y, 0.0, 0.0, color);
+    sosg_predict_add_vertex(&predict->lines, x1 + other - edge, y1, 0.0, 0.0, color);
+}
+
+// Move a satellite to where it now is on the map, adding a track segment from
+// the last point if it moved a pixel
+static void sosg_predict_locate(sosg_predict_p predict, int i)
+{
+    sats_p sats = &predict->sats;
+    
+    // convert LonW and LatN to equirectangular pixel coordinates, keeping
+    // the fraction so the sprites move smoothly between pixels
+    float x = fmod((float)(predict->size[0] - 1)*(540.0-sats->longitude[i])/360.0,
+        predict->size[0]);
+    // the map only holds the latitude band the globe can show
+    float y = (float)(predict->size[1] - 1)*((90.0-sats->latitude[i])/180.0
+        - predict->band[0])/(predict->band[1] - predict->band[0]);
+    int path_x = (int)floor(x), path_y = (int)floor(y);
+    
+    if (!sats->located[i] || path_x != sats->path_x[i] || path_y != sats->path_y[i]) {
+        // the track goes between pixel centers like the sprites
+        if (sats->located[i]) {
+            Uint32 color = sats->visibility[i] == 'V' ? PREDICT_VISIBLE : PREDICT_HIDDEN;
+            sosg_predict_add_track(predict, sats->path_x[i] + 0.5, sats->path_y[i] + 0.5,
+                path_x + 0.5, path_y + 0.5, color);
         }
-        if (!values || matched != 3) {
-            fprintf(stderr, "Warning: Malformed update for %s\n", input->name);
-            return -1;
+        sats->path_x[i] = path_x;
+        sats->path_y[i] = path_y;
+    }
+    
+    sats->x[i] = x;
+    sats->y[i] = y;
+    sats->located[i] = 1;
+}
+
+// Send a request for every satellite at once and take the replies in
+// whatever order they arrive, so a full refresh takes about one round trip
+// rather than one per satellite.  A request that goes unanswered is sent
+// again a couple of times before the satellite is skipped this refresh.
+static void sosg_predict_query_sats(sosg_predict_p predict)
+{
+    sats_p sats = &predict->sats;
+    char buf[PREDICT_SERVER_MTU + 1];
+    int i, pending = sats->count;
+    int requests = 0, replies = 0;
+
+    for (i = 0; i < sats->count; i++) {
+        sats->pending[i] = 1;
+        sats->tries[i] = 0;
+        // A failed send is just retried when it times out
+        sosg_predict_request(predict, i);
+        requests++;
+    }
+
+    while (pending && predict->running) {
+        SDLNet_CheckSockets(predict->sockset, PREDICT_POLL);
+        while (SDLNet_UDP_Recv(predict->sock, predict->packet) == 1) {
+            int len = predict->packet->len < PREDICT_SERVER_MTU ?
+                predict->packet->len : PREDICT_SERVER_MTU;
+            memcpy(buf, predict->packet->data, len);
+            buf[len] = '\0';
+
+            i = sosg_predict_parse(predict, buf);
+            if (i >= 0) {
+                sosg_predict_locate(predict, i);
+                sats->pending[i] = 0;
+                pending--;
+                replies++;
+            }
         }
-    } else {
-        fprintf(stderr, "Warning: Failed to update %s\n", input->name);
-        return -1;
+
+        Uint32 now = SDL_GetTicks();
+        for (i = 0; i < sats->count; i++) {
+            if (!sats->pending[i] || now - sats->sent[i] < PREDICT_REQUEST_TIMEOUT) continue;
+            if (sats->tries[i] < PREDICT_REQUEST_TRIES) {
+                sosg_predict_request(predict, i);
+                requests++;
+            } else {
+                fprintf(stderr, "Warning: Failed to update %s\n", sats->name[i]);
+                sats->pending[i] = 0;
+                pending--;
+            }
+        }
+    }
+
+    SDL_mutexP(predict->update_lock);
+    predict->requests += requests;
+    predict->replies += replies;
+    SDL_mutexV(predict->update_lock);
+    
+    if (requests > sats->count) {
+        fprintf(stderr, "Warning: %d of %d PREDICT requests went unanswered\n",
+            requests - replies, requests);
     }
+}
+
+// Work out where every satellite is right now from its TLE
+static void sosg_predict_propagate_sats(sosg_predict_p predict)
+{
+    sats_p sats = &predict->sats;
+    const float *longitude = NULL, *latitude = NULL;
+    const char *visibility = NULL;
+    struct timeval now;
+    int i = 0;
     
-    // convert LonW and LatN to equirectangular pixel coordinates
-    input->x = (int)floor((float)(predict->buffer->w - 1)*(540.0-input->longitude)/360.0)%predict->buffer->w;
-    input->y = (int)floor((float)(predict->buffer->h - 1)*(90.0-input->latitude)/180.0);
-//    printf("%s %f %f %c %d %d\n",input->name, input->longitude, input->latitude,
-//        input->visibility, input->x, input->y);
+    gettimeofday(&now, NULL);
+    sosg_sgp4_propagate(predict->sgp4, now.tv_sec + now.tv_usec/1000000.0);
+    sosg_sgp4_get_positions(predict->sgp4, &longitude, &latitude, &visibility);
     
-    return 0;
+    for (i = 0; i < sats->count; i++) {
+        if (visibility[i] != SGP4_FAILED) {
+            // PREDICT reports longitude west, so the rest expects that
+            sats->longitude[i] = -longitude[i];
+            sats->latitude[i] = latitude[i];
+            sats->visibility[i] = visibility[i];
+            sosg_predict_locate(predict, i);
+        } else {
+            // Decayed, so it stops being shown
+            sats->located[i] = 0;
+        }
+    }
 }
 
 static int sosg_predict_get_sats(sosg_predict_p predict)
 {
     char buf[PREDICT_SERVER_MTU];
     int len = PREDICT_SERVER_MTU;
-    int num_sats = 0;
+    int i = 0;
     char *savedptr = NULL;
 
-    if (!sosg_predict_message(predict, "GET_LIST\n", 9, buf, &len)) {
+    if (predict->sgp4) {
+        // in the same order, so the propagated arrays line up with ours
+        for (i = 0; i < sosg_sgp4_count(predict->sgp4); i++) {
+            if (sosg_predict_add_sat(predict, sosg_sgp4_name(predict->sgp4, i))) return -1;
+        }
+    } else if (!sosg_predict_message(predict, "GET_LIST\n", 9, buf, &len)) {
         // each line contains the name of one satellite
         char *sat = strtok_r(buf, "\n", &savedptr);
         while (sat) {
-            predict->sats[num_sats++].name = strdup(sat);
+            if (sosg_predict_add_sat(predict, sat)) return -1;
             sat = strtok_r(NULL, "\n", &savedptr);
         }
-        
-        predict->num_sats = num_sats;
     } else {
         fprintf(stderr, "Error: Failed to get satellite list\n");
         return -1;
     }
     
-    for (num_sats = 0; num_sats < predict->num_sats; num_sats++) {
-        char name[10];
-        // clip the name if it is long
-        int len = strlen(predict->sats[num_sats].name);
-        strncpy(name, predict->sats[num_sats].name, 9);
-        if (len > 9) {
-            name[7] = '~';
-            name[8] = predict->sats[num_sats].name[len-1];
-        }
-        name[9] = '\0';
-        
-        // generate a surface of the name
-        SDL_Color color = {255, 255, 255};
-        predict->sats[num_sats].name_surf = TTF_RenderText_Blended(predict->font,
-            name, color);
-            
-        // get an initial position
-        sosg_predict_update_sat(predict, predict->sats + num_sats);
-    }
+    sosg_predict_build_atlas(predict);
     
     return 0;
 }
 
 static int sosg_predict_update_sats(sosg_predict_p predict)
 {
+    Uint32 start = SDL_GetTicks();
     int i = 0;
-    SDL_Rect pos;
-    
-    for (i = 0; i < predict->num_sats; i++) {
-        int px = predict->sats[i].x;
-        int py = predict->sats[i].y;
-        if (!sosg_predict_update_sat(predict, predict->sats + i)) {
-            // draw a line segment from the last point to the new one if the
-            // satellite moved but didn't wrap around the screen
-            if ((px != predict->sats[i].x || py != predict->sats[i].y)
-             && (abs(predict->sats[i].x - px) < predict->path_surf->w/4))
-                thickLineColor(predict->path_surf, px, py, predict->sats[i].x,
-                    predict->sats[i].y, 5,
-                    (predict->sats[i].visibility == 'V' ? PREDICT_VISIBLE : PREDICT_HIDDEN));
-        }
+    
+    if (predict->sgp4) {
+        sosg_predict_propagate_sats(predict);
+    } else {
+        sosg_predict_query_sats(predict);
     }
     
-    // lock around blitting to the update_surf since it is used in the main thread
+    // The new track segments wait with any the render thread hasn't drawn
+    // yet, and the sprites just replace the last ones
     SDL_mutexP(predict->update_lock);
-    SDL_BlitSurface(predict->path_surf, NULL, predict->update_surf, NULL);
-    for (i = 0; i < predict->num_sats; i++) {
-        // TODO: deal with wrapping around the world
-        pos.x = predict->sats[i].x - predict->sat_icon->w/2;
-        pos.y = predict->sats[i].y - predict->sat_icon->h/2;
-        // highlight visible satellites
-        if (predict->sats[i].visibility == 'V') {
-            filledCircleColor(predict->update_surf, predict->sats[i].x, 
-                predict->sats[i].y, predict->sat_icon->w/2, PREDICT_VISIBLE);
-        }
-        SDL_BlitSurface(predict->sat_icon, NULL, predict->update_surf, &pos);
-        // put the name next to the icon
-        pos.x += predict->sat_icon->w;
-        SDL_BlitSurface(predict->sats[i].name_surf, NULL, predict->update_surf,
-            &pos);
+    for (i = 0; i < predict->lines.count; i++) {
+        vertex_p vertex = sosg_predict_new_vertex(predict->tracks);
+        if (!vertex) break;
+        *vertex = predict->lines.v[i];
     }
+    predict->lines.count = 0;
+    sosg_predict_build_sprites(predict, predict->sprites);
     predict->should_update = 1;
+    
+    predict->refreshes++;
+    predict->refresh_last = SDL_GetTicks() - start;
+    if (predict->refresh_last > predict->refresh_max)
+        predict->refresh_max = predict->refresh_last;
     SDL_mutexV(predict->update_lock);
+    sosg_source_wake(predict->ready);
     
     return 0;
 }
@@ -271,7 +779,7 @@ static int sosg_predict_client(void *data)
 {
     sosg_predict_p predict = (sosg_predict_p)data;
  
-    if (sosg_predict_client_init(predict)) {
+    if (!predict->sgp4 && sosg_predict_client_init(predict)) {
         sosg_predict_client_destroy(predict);
         return -1;
     }
@@ -290,7 +798,7 @@ static int sosg_predict_client(void *data)
         SDL_mutexP(predict->client_lock);
         // Using cond to sleep between polling the server while still being able
         // to end the thread quickly when destroy is called
-        if (SDL_CondWaitTimeout(predict->client_timeout, predict->client_lock, PREDICT_CLIENT_INTERVAL)
+        if (SDL_CondWaitTimeout(predict->client_timeout, predict->client_lock, predict->interval)
                 != SDL_MUTEX_TIMEDOUT)
             break;
     }
@@ -301,11 +809,30 @@ static int sosg_predict_client(void *data)
     return 0;   
 }
 
-sosg_predict_p sosg_predict_init(const char *path)
+sosg_predict_p sosg_predict_init(const char *path, char **tles, int num_tles,
+    int synthetic, sosg_limits_p limits, sosg_wake_p wake)
 {
     sosg_predict_p predict = calloc(1, sizeof(sosg_predict_t));
     if (predict) {
         if (path) predict->path = strdup(path);
+        predict->interval = PREDICT_CLIENT_INTERVAL;
+        predict->ready = wake;
+        if (num_tles || synthetic) {
+            predict->sgp4 = sosg_sgp4_init(tles, num_tles, synthetic);
+            if (!predict->sgp4) {
+                fprintf(stderr, "Error: Could not load any satellites from TLEs\n");
+                free(predict->path);
+                free(predict);
+                return NULL;
+            }
+            predict->interval = PREDICT_LOCAL_INTERVAL;
+        }
+        predict->band[0] = 0.0;
+        predict->band[1] = 1.0;
+        if (limits && limits->band[1] > limits->band[0]) {
+            predict->band[0] = limits->band[0];
+            predict->band[1] = limits->band[1];
+        }
         
         predict->update_lock = SDL_CreateMutex();
         predict->client_lock = SDL_CreateMutex();
@@ -314,18 +841,18 @@ sosg_predict_p sosg_predict_init(const char *path)
         TTF_Init();
         predict->font = TTF_OpenFont("orbitron-black.otf", 32);
         
-        SDL_Surface *surface = IMG_Load(predict->path);
+        SDL_Surface *surface = sosg_image_load_surface(predict->path, limits);
         if (surface) {
-            predict->buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w, 
-                surface->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-            predict->update_surf = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w, 
+            predict->map = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w, 
                 surface->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-            predict->path_surf = SDL_CreateRGBSurface(SDL_SWSURFACE, surface->w, 
-                surface->h, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-            SDL_BlitSurface(surface, NULL, predict->buffer, NULL);
-            SDL_BlitSurface(surface, NULL, predict->update_surf, NULL);
-            SDL_BlitSurface(surface, NULL, predict->path_surf, NULL);
+            if (predict->map) {
+                SDL_BlitSurface(surface, NULL, predict->map, NULL);
+                predict->size[0] = surface->w;
+                predict->size[1] = surface->h;
+            }
             SDL_FreeSurface(surface);
+            // Show the map before the first satellites come in
+            predict->should_update = 1;
         } else {
             fprintf(stderr, "Warning: Could not open image at %s\n", predict->path);
         }
@@ -345,7 +872,7 @@ sosg_predict_p sosg_predict_init(const char *path)
 void sosg_predict_destroy(sosg_predict_p predict)
 {
     int i = 0;
-
+    
     if (predict) {
         SDL_mutexP(predict->client_lock);
         predict->running = 0;
@@ -355,17 +882,24 @@ void sosg_predict_destroy(sosg_predict_p predict)
     
         if (predict->path) free(predict->path);
         if (predict->font) TTF_CloseFont(predict->font);
-        if (predict->buffer) SDL_FreeSurface(predict->buffer);
-        if (predict->update_surf) SDL_FreeSurface(predict->update_surf);
-        if (predict->path_surf) SDL_FreeSurface(predict->path_surf);
+        if (predict->map) SDL_FreeSurface(predict->map);
+        if (predict->lines.v) free(predict->lines.v);
+        for (i = 0; i < 2; i++) {
+            if (predict->sprites[i].v) free(predict->sprites[i].v);
+            if (predict->tracks[i].v) free(predict->tracks[i].v);
+        }
+        // Sources go away on the render thread, so the GL objects can too
+        if (predict->gpu.fbo[0]) glDeleteFramebuffersEXT(PREDICT_TARGETS, predict->gpu.fbo);
+        if (predict->gpu.textures[0]) glDeleteTextures(PREDICT_TARGETS, predict->gpu.textures);
+        if (predict->gpu.atlas) glDeleteTextures(1, &predict->gpu.atlas);
         if (predict->update_lock) SDL_DestroyMutex(predict->update_lock);
         if (predict->client_lock) SDL_DestroyMutex(predict->client_lock);
         if (predict->client_timeout) SDL_DestroyCond(predict->client_timeout);
-        for (i = 0; i < predict->num_sats; i++) {
-            if (predict->sats[i].name) free(predict->sats[i].name);
-            if (predict->sats[i].name_surf) SDL_FreeSurface(predict->sats[i].name_surf);
-        }
-        if (predict->sats) free(predict->sats);
+        sosg_predict_free_sats(predict);
+        if (predict->atlas.surface) SDL_FreeSurface(predict->atlas.surface);
+        if (predict->atlas.rects) free(predict->atlas.rects);
+        if (predict->sat_icon) SDL_FreeSurface(predict->sat_icon);
+        if (predict->sgp4) sosg_sgp4_destroy(predict->sgp4);
         
         free(predict);
         
@@ -375,23 +909,256 @@ void sosg_predict_destroy(sosg_predict_p predict)
 
 void sosg_predict_get_resolution(sosg_predict_p predict, int *resolution)
 {
-    if (resolution && predict && predict->buffer) {
-        resolution[0] = predict->buffer->w;
-        resolution[1] = predict->buffer->h;
+    if (resolution && predict && predict->size[0]) {
+        resolution[0] = predict->size[0];
+        resolution[1] = predict->size[1];
     }
 }
 
-SDL_Surface *sosg_predict_update(sosg_predict_p predict)
+int sosg_predict_update(sosg_predict_p predict)
 {
-    if (!predict) return NULL;
+    int updated = 0;
+    if (!predict) return 0;
     
-    // We only blit the surface if it was changed by the predict client thread
+    // We only pass the satellites on if they were moved by the predict client
+    // thread, the last frame stays up until then.  The render thread gets
+    // the latest sprites and every track it hasn't drawn yet.
     SDL_mutexP(predict->update_lock);
     if (predict->should_update) {
-        SDL_BlitSurface(predict->update_surf, NULL, predict->buffer, NULL);
+        verts_t swap = predict->sprites[0];
+        predict->sprites[0] = predict->sprites[1];
+        predict->sprites[1] = swap;
+        swap = predict->tracks[0];
+        predict->tracks[0] = predict->tracks[1];
+        predict->tracks[1] = swap;
+        predict->tracks[0].count = 0;
         predict->should_update = 0;
+        predict->presented++;
+        updated = 1;
     }
     SDL_mutexV(predict->update_lock);
     
-    return predict->buffer;
+    return updated;
+}
+
+// Make a texture the size of the map with a framebuffer to draw into it
+static int sosg_predict_target(sosg_predict_p predict, int target, GLint filter, void *pixels)
+{
+    gpu_p gpu = &predict->gpu;
+    
+    glBindTexture(GL_TEXTURE_2D, gpu->textures[target]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, predict->size[0], predict->size[1], 0,
+        GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+    
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, gpu->fbo[target]);
+    glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT,
+        GL_TEXTURE_2D, gpu->textures[target], 0);
+    GLenum status = glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT);
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE_EXT) {
+        fprintf(stderr, "Error: Could not draw satellites into a %dx%d texture (0x%x)\n",
+            predict->size[0], predict->size[1], status);
+        return -1;
+    }
+    
+    return 0;
+}
+
+// Take the map onto the GPU, where the tracks are drawn over it from then on
+static int sosg_predict_gl_init(sosg_predict_p predict)
+{
+    gpu_p gpu = &predict->gpu;
+    
+    if (!predict->map) return -1;
+    
+    glGenTextures(PREDICT_TARGETS, gpu->textures);
+    glGenFramebuffersEXT(PREDICT_TARGETS, gpu->fbo);
+    
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, predict->map->pitch/4);
+    // the path is copied pixel for pixel, and the frame is filtered by the globe
+    int failed = sosg_predict_target(predict, PREDICT_PATH, GL_NEAREST, predict->map->pixels)
+        || sosg_predict_target(predict, PREDICT_FRAME, GL_LINEAR, NULL);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if (failed) return -1;
+    
+    SDL_FreeSurface(predict->map);
+    predict->map = NULL;
+    
+    return 0;
+}
+
+// The atlas is done by the time there are sprites to draw from it
+static void sosg_predict_load_atlas(sosg_predict_p predict)
+{
+    SDL_Surface *surface = predict->atlas.surface;
+    
+    glGenTextures(1, &predict->gpu.atlas);
+    glBindTexture(GL_TEXTURE_2D, predict->gpu.atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, surface->pitch/4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, surface->w, surface->h, 0,
+        GL_BGRA, GL_UNSIGNED_BYTE, surface->pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    
+    // only the render thread looks at it now
+    SDL_FreeSurface(surface);
+    predict->atlas.surface = NULL;
+}
+
+unsigned int sosg_predict_render(sosg_predict_p predict)
+{
+    gpu_p gpu = &predict->gpu;
+    verts_p sprites = predict->sprites + 1, tracks = predict->tracks + 1;
+    float w = predict->size[0], h = predict->size[1];
+    GLint program = 0;
+    
+    if (gpu->failed) return 0;
+    if (!gpu->fbo[0] && sosg_predict_gl_init(predict)) {
+        gpu->failed = 1;
+        return 0;
+    }
+    if (!gpu->atlas && sprites->count && predict->atlas.surface) sosg_predict_load_atlas(predict);
+    
+    // Draw with the fixed pipeline in map pixels, with the first row at the
+    // bottom where a texture starts, and put back what the display uses
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glUseProgram(0);
+    glPushAttrib(GL_CURRENT_BIT | GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_LINE_BIT |
+        GL_TEXTURE_BIT | GL_VIEWPORT_BIT | GL_TRANSFORM_BIT);
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glActiveTexture(GL_TEXTURE0);
+    glViewport(0, 0, w, h);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    glOrtho(0, w, 0, h, -1, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    // blend the colors in, but the map stays opaque
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    
+    // Tracks are drawn into the path for good, so each one only goes up once
+    if (tracks->count) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, gpu->fbo[PREDICT_PATH]);
+        glDisable(GL_TEXTURE_2D);
+        glEnable(GL_BLEND);
+        glLineWidth(5.0);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(vertex_t), &tracks->v[0].x);
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(vertex_t), tracks->v[0].color);
+        glDrawArrays(GL_LINES, 0, tracks->count);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glEnable(GL_TEXTURE_2D);
+    }
+    
+    // Then the frame is the path with every satellite over it
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, gpu->fbo[PREDICT_FRAME]);
+    glDisable(GL_BLEND);
+    glColor4f(1.0, 1.0, 1.0, 1.0);
+    glBindTexture(GL_TEXTURE_2D, gpu->textures[PREDICT_PATH]);
+    glBegin(GL_QUADS);
+        glTexCoord2i(0, 0);
+        glVertex2f(0, 0);
+        glTexCoord2i(1, 0);
+        glVertex2f(w, 0);
+        glTexCoord2i(1, 1);
+        glVertex2f(w, h);
+        glTexCoord2i(0, 1);
+        glVertex2f(0, h);
+    glEnd();
+    
+    if (sprites->count && gpu->atlas) {
+        glEnable(GL_BLEND);
+        glBindTexture(GL_TEXTURE_2D, gpu->atlas);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glVertexPointer(2, GL_FLOAT, sizeof(vertex_t), &sprites->v[0].x);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(vertex_t), &sprites->v[0].u);
+        glDrawArrays(GL_QUADS, 0, sprites->count);
+    }
+    
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glPopClientAttrib();
+    glPopAttrib();
+    glUseProgram(program);
+    
+    return gpu->textures[PREDICT_FRAME];
+}
+
+static void *predict_init(sosg_source_config_p config)
+{
+    // The map is the last path given, after any TLE files
+    if (!config->num_paths) return sosg_predict_init(NULL, NULL, 0, config->synthetic,
+        config->limits, config->wake);
+    return sosg_predict_init(config->paths[config->num_paths - 1], config->paths,
+        config->num_paths - 1, config->synthetic, config->limits, config->wake);
+}
+
+static void predict_destroy(void *source)
+{
+    sosg_predict_destroy(source);
 }
+
+static int predict_acquire_frame(void *source, sosg_frame_p frame)
+{
+    sosg_predict_p predict = source;
+    if (!sosg_predict_update(predict)) return 0;
+    
+    // Drawn into a texture by predict_render once it gets to the render thread
+    memset(frame, 0, sizeof(sosg_frame_t));
+    frame->format = SOSG_FRAME_TEXTURE;
+    frame->w = predict->size[0];
+    frame->h = predict->size[1];
+    frame->sequence = predict->presented;
+    return 1;
+}
+
+static void predict_render(void *source, sosg_frame_p frame)
+{
+    frame->texture = sosg_predict_render(source);
+}
+
+static void predict_get_resolution(void *source, int *resolution)
+{
+    sosg_predict_get_resolution(source, resolution);
+}
+
+static void predict_get_stats(void *source, sosg_source_stats_p stats)
+{
+    sosg_predict_p predict = source;
+    if (predict && stats) {
+        memset(stats, 0, sizeof(sosg_source_stats_t));
+        SDL_mutexP(predict->update_lock);
+        stats->presented = predict->presented;
+        stats->refreshes = predict->refreshes;
+        stats->refresh_last = predict->refresh_last;
+        stats->refresh_max = predict->refresh_max;
+        stats->requests = predict->requests;
+        stats->lost = predict->requests - predict->replies;
+        SDL_mutexV(predict->update_lock);
+    }
+}
+
+sosg_source_t sosg_predict_source = {
+    "Predict",
+    predict_init,
+    predict_destroy,
+    NULL,
+    NULL,
+    predict_acquire_frame,
+    NULL,
+    predict_get_resolution,
+    predict_get_stats,
+    predict_render,
+    NULL
+};
@@ -2,12 +2,18 @@
 #define _SOSG_PREDICT_H_
 
 #include "SDL.h"
+#include "sosg_warp.h"
+#include "sosg_source.h"
 
 typedef struct sosg_predict_struct *sosg_predict_p;
 
-sosg_predict_p sosg_predict_init(const char *path);
+extern sosg_source_t sosg_predict_source;
+
+sosg_predict_p sosg_predict_init(const char *path, char **tles, int num_tles,
+    int synthetic, sosg_limits_p limits, sosg_wake_p wake);
 void sosg_predict_destroy(sosg_predict_p predict);
 void sosg_predict_get_resolution(sosg_predict_p predict, int *resolution);
-SDL_Surface *sosg_predict_update(sosg_predict_p predict);
+int sosg_predict_update(sosg_predict_p predict);
+unsigned int sosg_predict_render(sosg_predict_p predict);
 
 #endif /* _SOSG_PREDICT_H_ */
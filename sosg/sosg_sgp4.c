@@ -0,0 +1,630 @@
+#include "sosg_sgp4.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// The near earth part of SGP4 as in Vallado et al. "Revisiting Spacetrack
+// Report #3", with the WGS-72 constants TLEs are made with.  Deep space
+// objects, with periods of 225 minutes or more, are propagated the same way
+// without the lunar and solar terms, so they drift further from where they
+// really are the older their elements get.
+#define SGP4_RADIUS 6378.135
+#define SGP4_XKE 0.0743669161331734
+#define SGP4_J2 0.001082616
+#define SGP4_J3 -0.00000253881
+#define SGP4_J4 -0.00000165597
+#define SGP4_FLATTENING (1.0/298.26)
+#define SGP4_KEPLER_STEPS 10
+// How far the sun is below the horizon when the ground counts as dark
+#define SGP4_TWILIGHT -0.10452846326765347
+
+#define TWO_PI 6.283185307179586
+#define PI_2 1.5707963267948966
+#define DEG_TO_RAD 0.017453292519943295
+#define RAD_TO_DEG 57.29577951308232
+
+// Mean elements as read from a TLE, only used while loading
+typedef struct elements_struct {
+    char *name;
+    double epoch;   // Unix time
+    double no;      // Radians per minute
+    double ecco;
+    double inclo;
+    double nodeo;
+    double argpo;
+    double mo;
+    double bstar;
+} elements, *elements_p;
+
+// Everything is kept as one array per value so each stage of propagation is
+// a plain loop over all satellites that the compiler can vectorize
+typedef struct sosg_sgp4_struct {
+    int count;
+    char **names;
+    double *data;
+
+    // From the elements
+    double *epoch;
+    double *no;
+    double *ao;
+    double *ecco;
+    double *inclo;
+    double *nodeo;
+    double *argpo;
+    double *mo;
+    double *bstar;
+
+    // Set up once from the elements
+    double *mdot;
+    double *argpdot;
+    double *nodedot;
+    double *nodecf;
+    double *cc1;
+    double *cc4;
+    double *cc5;
+    double *d2;
+    double *d3;
+    double *d4;
+    double *t2cof;
+    double *t3cof;
+    double *t4cof;
+    double *t5cof;
+    double *omgcof;
+    double *xmcof;
+    double *eta;
+    double *delmo;
+    double *sinmao;
+    double *aycof;
+    double *xlcof;
+    double *con41;
+    double *x1mth2;
+    double *x7thm1;
+    double *cosio;
+    double *sinio;
+
+    // Passed between the stages of propagation
+    double *am;
+    double *axnl;
+    double *aynl;
+    double *nodep;
+    double *u;
+    double *eo1;
+    double *valid;
+    double *shade;
+
+    float *longitude;
+    float *latitude;
+    char *visibility;
+} sosg_sgp4_t;
+
+#define SGP4_NUM_ARRAYS 43
+
+// Keep angles within a turn either way for the trig, by truncating rather
+// than with floor, which only vectorizes from SSE 4.1 on
+static double wrap(double angle)
+{
+    return angle - TWO_PI*(int)(angle/TWO_PI);
+}
+
+// GCC merges the sine and cosine of one angle into a sincos, which has no
+// vector version, so loops that need both take the cosine as a sine
+static double cosine(double angle)
+{
+    return sin(angle + PI_2);
+}
+
+// Julian date of a unix time
+static double julian(double time)
+{
+    return time/86400.0 + 2440587.5;
+}
+
+static double field(const char *line, int start, int length)
+{
+    char buf[16];
+    memcpy(buf, line + start, length);
+    buf[length] = '\0';
+    return atof(buf);
+}
+
+// Parse the two element lines, which have fixed columns and implied decimal
+// points in places
+static int sgp4_parse(const char *line1, const char *line2, elements_p e)
+{
+    char buf[16];
+
+    if (strlen(line1) < 63 || strlen(line2) < 63 || line1[0] != '1' || line2[0] != '2')
+        return -1;
+
+    int year = (int)field(line1, 18, 2);
+    year += year < 57 ? 2000 : 1900;
+    // The day of the year counts from 1, on top of the Julian date of Jan 1
+    double jd = 367.0*year - (7*year)/4 + 1721044.5 + field(line1, 20, 12) - 1.0;
+    e->epoch = (jd - 2440587.5)*86400.0;
+
+    snprintf(buf, sizeof(buf), "%c.%.5s", line1[53] == '-' ? '-' : '+', line1 + 54);
+    e->bstar = atof(buf)*pow(10.0, field(line1, 59, 2));
+
+    e->inclo = field(line2, 8, 8)*DEG_TO_RAD;
+    e->nodeo = field(line2, 17, 8)*DEG_TO_RAD;
+    snprintf(buf, sizeof(buf), "0.%.7s", line2 + 26);
+    e->ecco = atof(buf);
+    e->argpo = field(line2, 34, 8)*DEG_TO_RAD;
+    e->mo = field(line2, 43, 8)*DEG_TO_RAD;
+    e->no = field(line2, 52, 11)*TWO_PI/1440.0;
+
+    if (e->no <= 0.0 || e->ecco >= 1.0) return -1;
+
+    return 0;
+}
+
+// Add the element sets from a file with optional name lines, as in the
+// Celestrak and Space-Track formats
+static int sgp4_read(const char *path, elements_p *sets, int *count, int *size)
+{
+    char line[128], line1[128], name[128];
+    int loaded = 0;
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open TLE file %s\n", path);
+        return -1;
+    }
+
+    line1[0] = '\0';
+    name[0] = '\0';
+    while (fgets(line, sizeof(line), file)) {
+        int len = strlen(line);
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+            line[--len] = '\0';
+        if (!len) continue;
+
+        if (line[0] == '1' && line[1] == ' ') {
+            strcpy(line1, line);
+        } else if (line[0] == '2' && line[1] == ' ' && line1[0]) {
+            if (*count == *size) {
+                int grown = *size ? *size*2 : 256;
+                elements_p more = realloc(*sets, grown*sizeof(elements));
+                if (!more) break;
+                *sets = more;
+                *size = grown;
+            }
+            elements_p e = *sets + *count;
+            if (sgp4_parse(line1, line, e)) {
+                fprintf(stderr, "Warning: Skipping malformed TLE %s in %s\n",
+                    name[0] ? name : line1, path);
+            } else {
+                // Without a name line the catalog number will do
+                if (!name[0]) snprintf(name, sizeof(name), "%.5s", line1 + 2);
+                e->name = strdup(name);
+                (*count)++;
+                loaded++;
+            }
+            line1[0] = '\0';
+            name[0] = '\0';
+        } else {
+            // The three line format starts names with a zero
+            strcpy(name, strncmp(line, "0 ", 2) ? line : line + 2);
+            line1[0] = '\0';
+        }
+    }
+    fclose(file);
+
+    if (!loaded) fprintf(stderr, "Warning: No TLEs in %s\n", path);
+
+    return loaded;
+}
+
+// Make up satellites in low orbits at every inclination and phase, as of
+// now, for benchmarking without a catalog at hand.  They are the same every
+// run.
+static int sgp4_synthesize(int n, elements_p *sets, int *count, int *size)
+{
+    char name[32];
+    unsigned int seed = 1;
+    int i, j;
+
+    if (*count + n > *size) {
+        elements_p more = realloc(*sets, (*count + n)*sizeof(elements));
+        if (!more) return -1;
+        *sets = more;
+        *size = *count + n;
+    }
+
+    for (i = 0; i < n; i++) {
+        double r[6];
+        for (j = 0; j < 6; j++) {
+            seed = seed*1664525 + 1013904223;
+            r[j] = (seed >> 8)/16777216.0;
+        }
+        elements_p e = *sets + (*count)++;
+        e->epoch = time(NULL);
+        // 12 to 16 orbits a day, as most of a real catalog is
+        e->no = (12.0 + 4.0*r[0])*TWO_PI/1440.0;
+        e->ecco = 0.02*r[1];
+        e->inclo = 100.0*r[2]*DEG_TO_RAD;
+        e->nodeo = TWO_PI*r[3];
+        e->argpo = TWO_PI*r[4];
+        e->mo = TWO_PI*r[5];
+        e->bstar = 0.0001;
+        snprintf(name, sizeof(name), "SYNTHETIC %d", i + 1);
+        e->name = strdup(name);
+    }
+
+    return n;
+}
+
+// Work out everything that does not depend on time, which is most of SGP4
+static void sgp4_setup(sosg_sgp4_p sgp4, int i, elements_p e)
+{
+    double ecco = e->ecco, inclo = e->inclo, argpo = e->argpo, bstar = e->bstar;
+    double j3oj2 = SGP4_J3/SGP4_J2;
+
+    sgp4->names[i] = e->name;
+    sgp4->epoch[i] = e->epoch;
+    sgp4->ecco[i] = ecco;
+    sgp4->inclo[i] = inclo;
+    sgp4->nodeo[i] = e->nodeo;
+    sgp4->argpo[i] = argpo;
+    sgp4->mo[i] = e->mo;
+    sgp4->bstar[i] = bstar;
+
+    // Recover the original mean motion from the Kozai one in the TLE
+    double cosio = cos(inclo), sinio = sin(inclo);
+    double cosio2 = cosio*cosio;
+    double omeosq = 1.0 - ecco*ecco;
+    double rteosq = sqrt(omeosq);
+    double ak = pow(SGP4_XKE/e->no, 2.0/3.0);
+    double d1 = 0.75*SGP4_J2*(3.0*cosio2 - 1.0)/(rteosq*omeosq);
+    double del = d1/(ak*ak);
+    double adel = ak*(1.0 - del*del - del*(1.0/3.0 + 134.0*del*del/81.0));
+    del = d1/(adel*adel);
+    double no = e->no/(1.0 + del);
+
+    double ao = pow(SGP4_XKE/no, 2.0/3.0);
+    double po = ao*omeosq;
+    double con42 = 1.0 - 5.0*cosio2;
+    double con41 = -con42 - cosio2 - cosio2;
+    double posq = po*po;
+    double rp = ao*(1.0 - ecco);
+
+    // Low perigees get a simpler drag model and a lower atmosphere
+    int isimp = rp < 220.0/SGP4_RADIUS + 1.0;
+    double sfour = 78.0/SGP4_RADIUS + 1.0;
+    double qzms24 = pow(42.0/SGP4_RADIUS, 4.0);
+    double perige = (rp - 1.0)*SGP4_RADIUS;
+    if (perige < 156.0) {
+        sfour = perige < 98.0 ? 20.0 : perige - 78.0;
+        qzms24 = pow((120.0 - sfour)/SGP4_RADIUS, 4.0);
+        sfour = sfour/SGP4_RADIUS + 1.0;
+    }
+
+    double pinvsq = 1.0/posq;
+    double tsi = 1.0/(ao - sfour);
+    double eta = ao*ecco*tsi;
+    double etasq = eta*eta;
+    double eeta = ecco*eta;
+    double psisq = fabs(1.0 - etasq);
+    double coef = qzms24*pow(tsi, 4.0);
+    double coef1 = coef/pow(psisq, 3.5);
+    double cc2 = coef1*no*(ao*(1.0 + 1.5*etasq + eeta*(4.0 + etasq))
+        + 0.375*SGP4_J2*tsi/psisq*con41*(8.0 + 3.0*etasq*(8.0 + etasq)));
+    double cc1 = bstar*cc2;
+    double cc3 = ecco > 1.0e-4 ? -2.0*coef*tsi*j3oj2*no*sinio/ecco : 0.0;
+    double x1mth2 = 1.0 - cosio2;
+    double cc4 = 2.0*no*coef1*ao*omeosq*(eta*(2.0 + 0.5*etasq) + ecco*(0.5 + 2.0*etasq)
+        - SGP4_J2*tsi/(ao*psisq)*(-3.0*con41*(1.0 - 2.0*eeta + etasq*(1.5 - 0.5*eeta))
+        + 0.75*x1mth2*(2.0*etasq - eeta*(1.0 + etasq))*cos(2.0*argpo)));
+    double cc5 = 2.0*coef1*ao*omeosq*(1.0 + 2.75*(etasq + eeta) + eeta*etasq);
+    double cosio4 = cosio2*cosio2;
+    double temp1 = 1.5*SGP4_J2*pinvsq*no;
+    double temp2 = 0.5*temp1*SGP4_J2*pinvsq;
+    double temp3 = -0.46875*SGP4_J4*pinvsq*pinvsq*no;
+    double xhdot1 = -temp1*cosio;
+
+    sgp4->no[i] = no;
+    sgp4->ao[i] = ao;
+    sgp4->mdot[i] = no + 0.5*temp1*rteosq*con41
+        + 0.0625*temp2*rteosq*(13.0 - 78.0*cosio2 + 137.0*cosio4);
+    sgp4->argpdot[i] = -0.5*temp1*con42 + 0.0625*temp2*(7.0 - 114.0*cosio2 + 395.0*cosio4)
+        + temp3*(3.0 - 36.0*cosio2 + 49.0*cosio4);
+    sgp4->nodedot[i] = xhdot1 + (0.5*temp2*(4.0 - 19.0*cosio2)
+        + 2.0*temp3*(3.0 - 7.0*cosio2))*cosio;
+    sgp4->nodecf[i] = 3.5*omeosq*xhdot1*cc1;
+    sgp4->cc1[i] = cc1;
+    sgp4->cc4[i] = cc4;
+    sgp4->t2cof[i] = 1.5*cc1;
+    sgp4->eta[i] = eta;
+    sgp4->delmo[i] = pow(1.0 + eta*cos(e->mo), 3.0);
+    sgp4->sinmao[i] = sin(e->mo);
+    sgp4->aycof[i] = -0.5*j3oj2*sinio;
+    sgp4->xlcof[i] = -0.25*j3oj2*sinio*(3.0 + 5.0*cosio)
+        /(fabs(cosio + 1.0) > 1.5e-12 ? 1.0 + cosio : 1.5e-12);
+    sgp4->con41[i] = con41;
+    sgp4->x1mth2[i] = x1mth2;
+    sgp4->x7thm1[i] = 7.0*cosio2 - 1.0;
+    sgp4->cosio[i] = cosio;
+    sgp4->sinio[i] = sinio;
+
+    // Leaving the higher order terms at zero for the simple model makes
+    // propagation the same for every satellite, with no branches
+    if (!isimp) {
+        double cc1sq = cc1*cc1;
+        double d2 = 4.0*ao*tsi*cc1sq;
+        double temp = d2*tsi*cc1/3.0;
+        double d3 = (17.0*ao + sfour)*temp;
+        double d4 = 0.5*temp*ao*tsi*(221.0*ao + 31.0*sfour)*cc1;
+        sgp4->cc5[i] = cc5;
+        sgp4->d2[i] = d2;
+        sgp4->d3[i] = d3;
+        sgp4->d4[i] = d4;
+        sgp4->t3cof[i] = d2 + 2.0*cc1sq;
+        sgp4->t4cof[i] = 0.25*(3.0*d3 + cc1*(12.0*d2 + 10.0*cc1sq));
+        sgp4->t5cof[i] = 0.2*(3.0*d4 + 12.0*cc1*d3 + 6.0*d2*d2 + 15.0*cc1sq*(2.0*d2 + cc1sq));
+        sgp4->omgcof[i] = bstar*cc3*cos(argpo);
+        sgp4->xmcof[i] = ecco > 1.0e-4 ? -2.0/3.0*coef*bstar/eeta : 0.0;
+    }
+}
+
+static int sgp4_alloc(sosg_sgp4_p sgp4, int count)
+{
+    int i = 0;
+
+    sgp4->names = calloc(count, sizeof(char *));
+    sgp4->data = calloc((size_t)count*SGP4_NUM_ARRAYS, sizeof(double));
+    sgp4->longitude = calloc(count, sizeof(float));
+    sgp4->latitude = calloc(count, sizeof(float));
+    sgp4->visibility = calloc(count, sizeof(char));
+    if (!sgp4->names || !sgp4->data || !sgp4->longitude || !sgp4->latitude
+     || !sgp4->visibility)
+        return -1;
+
+    double **arrays[SGP4_NUM_ARRAYS] = {
+        &sgp4->epoch, &sgp4->no, &sgp4->ao, &sgp4->ecco, &sgp4->inclo, &sgp4->nodeo,
+        &sgp4->argpo, &sgp4->mo, &sgp4->bstar, &sgp4->mdot, &sgp4->argpdot,
+        &sgp4->nodedot, &sgp4->nodecf, &sgp4->cc1, &sgp4->cc4, &sgp4->cc5,
+        &sgp4->d2, &sgp4->d3, &sgp4->d4, &sgp4->t2cof, &sgp4->t3cof,
+        &sgp4->t4cof, &sgp4->t5cof, &sgp4->omgcof, &sgp4->xmcof, &sgp4->eta,
+        &sgp4->delmo, &sgp4->sinmao, &sgp4->aycof, &sgp4->xlcof, &sgp4->con41,
+        &sgp4->x1mth2, &sgp4->x7thm1, &sgp4->cosio, &sgp4->sinio, &sgp4->am,
+        &sgp4->axnl, &sgp4->aynl, &sgp4->nodep, &sgp4->u, &sgp4->eo1,
+        &sgp4->valid, &sgp4->shade
+    };
+    for (i = 0; i < SGP4_NUM_ARRAYS; i++) {
+        *arrays[i] = sgp4->data + (size_t)i*count;
+    }
+    sgp4->count = count;
+
+    return 0;
+}
+
+sosg_sgp4_p sosg_sgp4_init(char **paths, int num_paths, int synthetic)
+{
+    elements_p sets = NULL;
+    int count = 0, size = 0, i = 0;
+
+    for (i = 0; i < num_paths; i++) {
+        sgp4_read(paths[i], &sets, &count, &size);
+    }
+    if (synthetic > 0 && sgp4_synthesize(synthetic, &sets, &count, &size) < 0)
+        fprintf(stderr, "Error: Could not make %d synthetic satellites\n", synthetic);
+    if (!count) {
+        if (sets) free(sets);
+        return NULL;
+    }
+
+    sosg_sgp4_p sgp4 = calloc(1, sizeof(sosg_sgp4_t));
+    if (sgp4 && !sgp4_alloc(sgp4, count)) {
+        for (i = 0; i < count; i++) {
+            sgp4_setup(sgp4, i, sets + i);
+        }
+    } else {
+        fprintf(stderr, "Error: Could not allocate %d satellites\n", count);
+        for (i = 0; i < count; i++) {
+            free(sets[i].name);
+        }
+        if (sgp4) {
+            // The names were never handed over
+            sgp4->count = 0;
+            sosg_sgp4_destroy(sgp4);
+        }
+        sgp4 = NULL;
+    }
+    free(sets);
+
+    return sgp4;
+}
+
+void sosg_sgp4_destroy(sosg_sgp4_p sgp4)
+{
+    int i = 0;
+
+    if (sgp4) {
+        if (sgp4->names) {
+            for (i = 0; i < sgp4->count; i++) {
+                if (sgp4->names[i]) free(sgp4->names[i]);
+            }
+            free(sgp4->names);
+        }
+        if (sgp4->data) free(sgp4->data);
+        if (sgp4->longitude) free(sgp4->longitude);
+        if (sgp4->latitude) free(sgp4->latitude);
+        if (sgp4->visibility) free(sgp4->visibility);
+        free(sgp4);
+    }
+}
+
+int sosg_sgp4_count(sosg_sgp4_p sgp4)
+{
+    return sgp4 ? sgp4->count : 0;
+}
+
+const char *sosg_sgp4_name(sosg_sgp4_p sgp4, int index)
+{
+    if (!sgp4 || index < 0 || index >= sgp4->count) return NULL;
+    return sgp4->names[index];
+}
+
+// Secular gravity and drag, up to the solution of Kepler's equation.  The
+// stages each write only through restrict pointers, so the compiler can
+// vectorize them without checking whether the arrays overlap.
+static void sgp4_secular(const sosg_sgp4_t *s, double time, double *restrict am,
+    double *restrict axnl, double *restrict aynl, double *restrict nodep,
+    double *restrict u, double *restrict valid)
+{
+    int i = 0;
+
+    for (i = 0; i < s->count; i++) {
+        double t = (time - s->epoch[i])/60.0;
+        double t2 = t*t, t3 = t2*t, t4 = t3*t;
+        double xmdf = s->mo[i] + s->mdot[i]*t;
+        double argpdf = s->argpo[i] + s->argpdot[i]*t;
+        double nodem = s->nodeo[i] + s->nodedot[i]*t + s->nodecf[i]*t2;
+        double delomg = s->omgcof[i]*t;
+        double delm = 1.0 + s->eta[i]*cos(xmdf);
+        delm = s->xmcof[i]*(delm*delm*delm - s->delmo[i]);
+        double mm = xmdf + delomg + delm;
+        double argpm = argpdf - delomg - delm;
+        double tempa = 1.0 - s->cc1[i]*t - s->d2[i]*t2 - s->d3[i]*t3 - s->d4[i]*t4;
+        double tempe = s->bstar[i]*(s->cc4[i]*t + s->cc5[i]*(sin(mm) - s->sinmao[i]));
+        double templ = s->t2cof[i]*t2 + s->t3cof[i]*t3 + t4*(s->t4cof[i] + t*s->t5cof[i]);
+
+        double a = s->ao[i]*tempa*tempa;
+        double em = s->ecco[i] - tempe;
+        // Past these the orbit has decayed or the elements were bad
+        valid[i] = em < 1.0 && em >= -0.001 && a > 0.95 ? 1.0 : 0.0;
+        em = fmin(fmax(em, 1.0e-6), 0.999);
+        a = fmax(a, 0.95);
+        mm += s->no[i]*templ;
+
+        double temp = 1.0/(a*(1.0 - em*em));
+        double ax = em*cosine(argpm);
+        am[i] = a;
+        axnl[i] = ax;
+        aynl[i] = em*sin(argpm) + temp*s->aycof[i];
+        nodep[i] = wrap(nodem);
+        u[i] = wrap(mm + argpm + temp*s->xlcof[i]*ax);
+    }
+}
+
+// Newton's method a fixed number of times, which is plenty for anything but
+// the most eccentric orbits, instead of until each one converges
+static void sgp4_kepler(int count, const double *restrict u, const double *restrict axnl,
+    const double *restrict aynl, double *restrict eo1)
+{
+    int i = 0, k = 0;
+
+    for (i = 0; i < count; i++) {
+        eo1[i] = u[i];
+    }
+    for (k = 0; k < SGP4_KEPLER_STEPS; k++) {
+        for (i = 0; i < count; i++) {
+            double e = eo1[i];
+            double sineo1 = sin(e), coseo1 = cosine(e);
+            double step = (u[i] - aynl[i]*coseo1 + axnl[i]*sineo1 - e)
+                /(1.0 - coseo1*axnl[i] - sineo1*aynl[i]);
+            eo1[i] = e + fmin(fmax(step, -0.95), 0.95);
+        }
+    }
+}
+
+// Short period terms, then down to the ground, in Earth radii
+static void sgp4_ground(const sosg_sgp4_t *s, double time, float *restrict longitude,
+    float *restrict latitude, double *restrict shade)
+{
+    int i = 0, k = 0;
+
+    // Where the sun is and the Earth's rotation, for everything at once
+    double tut1 = (julian(time) - 2451545.0)/36525.0;
+    double gmst = wrap((-6.2e-6*tut1*tut1*tut1 + 0.093104*tut1*tut1
+        + (876600.0*3600.0 + 8640184.812866)*tut1 + 67310.54841)*DEG_TO_RAD/240.0);
+    double lsun = (280.460 + 36000.771*tut1)*DEG_TO_RAD;
+    double msun = (357.5291092 + 35999.05034*tut1)*DEG_TO_RAD;
+    double lecliptic = lsun + (1.914666471*sin(msun) + 0.019994643*sin(2.0*msun))*DEG_TO_RAD;
+    double obliquity = (23.439291 - 0.0130042*tut1)*DEG_TO_RAD;
+    double sun[3] = {cos(lecliptic), cos(obliquity)*sin(lecliptic), sin(obliquity)*sin(lecliptic)};
+    double e2 = SGP4_FLATTENING*(2.0 - SGP4_FLATTENING);
+
+    for (i = 0; i < s->count; i++) {
+        double a = s->am[i], ax = s->axnl[i], ay = s->aynl[i];
+        double sineo1 = sin(s->eo1[i]), coseo1 = cosine(s->eo1[i]);
+        double ecose = ax*coseo1 + ay*sineo1;
+        double esine = ax*sineo1 - ay*coseo1;
+        double el2 = fmin(ax*ax + ay*ay, 0.999);
+        double pl = a*(1.0 - el2);
+        double rl = a*(1.0 - ecose);
+        double betal = sqrt(1.0 - el2);
+        double temp = esine/(1.0 + betal);
+        double sinu = a/rl*(sineo1 - ay - ax*temp);
+        double cosu = a/rl*(coseo1 - ax + ay*temp);
+        double su = atan2(sinu, cosu);
+        double sin2u = (cosu + cosu)*sinu;
+        double cos2u = 1.0 - 2.0*sinu*sinu;
+        double temp1 = 0.5*SGP4_J2/pl;
+        double temp2 = temp1/pl;
+        double cosio = s->cosio[i], sinio = s->sinio[i];
+
+        double mrt = rl*(1.0 - 1.5*temp2*betal*s->con41[i]) + 0.5*temp1*s->x1mth2[i]*cos2u;
+        su -= 0.25*temp2*s->x7thm1[i]*sin2u;
+        double xnode = s->nodep[i] + 1.5*temp2*cosio*sin2u;
+        double xinc = s->inclo[i] + 1.5*temp2*cosio*sinio*cos2u;
+
+        double sinsu = sin(su), cossu = cosine(su);
+        double snod = sin(xnode), cnod = cosine(xnode);
+        double sini = sin(xinc), cosi = cosine(xinc);
+        double x = mrt*(cnod*cossu - snod*cosi*sinsu);
+        double y = mrt*(snod*cossu + cnod*cosi*sinsu);
+        double z = mrt*sini*sinsu;
+
+        // Geodetic latitude converges in a couple of steps this close in
+        double rxy = sqrt(x*x + y*y);
+        double lat = atan2(z, rxy);
+        for (k = 0; k < 3; k++) {
+            double sinlat = sin(lat);
+            double c = 1.0/sqrt(1.0 - e2*sinlat*sinlat);
+            lat = atan2(z + c*e2*sinlat, rxy);
+        }
+        double lon = atan2(y, x) - gmst;
+        lon += lon < -M_PI ? TWO_PI : 0.0;
+
+        // The shadow of the Earth is taken to be a cylinder, and the ground
+        // is dark once the sun is past civil twilight
+        double along = x*sun[0] + y*sun[1] + z*sun[2];
+        double lit = along < 0.0 && mrt*mrt - along*along < 1.0 ? SGP4_ECLIPSED
+            : along < SGP4_TWILIGHT*mrt ? SGP4_VISIBLE : SGP4_DAYLIGHT;
+
+        longitude[i] = lon*RAD_TO_DEG;
+        latitude[i] = lat*RAD_TO_DEG;
+        shade[i] = s->valid[i] > 0.5 && mrt >= 1.0 ? lit : SGP4_FAILED;
+    }
+}
+
+// Propagate every satellite to a unix time, and find the point on the ground
+// under each and whether it can be seen
+void sosg_sgp4_propagate(sosg_sgp4_p sgp4, double time)
+{
+    int i = 0;
+
+    if (!sgp4) return;
+
+    sgp4_secular(sgp4, time, sgp4->am, sgp4->axnl, sgp4->aynl, sgp4->nodep, sgp4->u,
+        sgp4->valid);
+    sgp4_kepler(sgp4->count, sgp4->u, sgp4->axnl, sgp4->aynl, sgp4->eo1);
+    sgp4_ground(sgp4, time, sgp4->longitude, sgp4->latitude, sgp4->shade);
+    // Mixing chars into the loops above would keep them from vectorizing
+    char *visibility = sgp4->visibility;
+    for (i = 0; i < sgp4->count; i++) {
+        visibility[i] = (char)sgp4->shade[i];
+    }
+}
+
+void sosg_sgp4_get_positions(sosg_sgp4_p sgp4, const float **longitude,
+    const float **latitude, const char **visibility)
+{
+    if (!sgp4) return;
+    if (longitude) *longitude = sgp4->longitude;
+    if (latitude) *latitude = sgp4->latitude;
+    if (visibility) *visibility = sgp4->visibility;
+}
@@ -0,0 +1,22 @@
+#ifndef _SOSG_SGP4_H_
+#define _SOSG_SGP4_H_
+
+typedef struct sosg_sgp4_struct *sosg_sgp4_p;
+
+// Visibility of a propagated satellite, using the letters PREDICT reports
+enum sosg_sgp4_visibility {
+    SGP4_FAILED = '\0',     // Decayed or the elements are no good
+    SGP4_VISIBLE = 'V',     // Sunlit over ground in darkness
+    SGP4_DAYLIGHT = 'D',    // Sunlit over ground in daylight
+    SGP4_ECLIPSED = 'N'     // In the shadow of the Earth
+};
+
+sosg_sgp4_p sosg_sgp4_init(char **paths, int num_paths, int synthetic);
+void sosg_sgp4_destroy(sosg_sgp4_p sgp4);
+int sosg_sgp4_count(sosg_sgp4_p sgp4);
+const char *sosg_sgp4_name(sosg_sgp4_p sgp4, int index);
+void sosg_sgp4_propagate(sosg_sgp4_p sgp4, double time);
+void sosg_sgp4_get_positions(sosg_sgp4_p sgp4, const float **longitude,
+    const float **latitude, const char **visibility);
+
+#endif /* _SOSG_SGP4_H_ */
@@ -0,0 +1,32 @@
+#include "sosg_source.h"
+#include <string.h>
+
+// Describe a surface the source keeps ownership of, for sources that already
+// work in SDL surfaces
+int sosg_frame_from_surface(sosg_frame_p frame, SDL_Surface *surface, Uint32 sequence)
+{
+    if (!frame || !surface) return 0;
+
+    memset(frame, 0, sizeof(sosg_frame_t));
+    // Planar YUV video comes packed in a single 8 bit surface
+    frame->format = surface->format->BytesPerPixel == 1 ? SOSG_FRAME_YUV : SOSG_FRAME_BGRA;
+    frame->w = surface->w;
+    frame->h = surface->h;
+    frame->pitch = surface->pitch;
+    frame->pixels = surface->pixels;
+    frame->sequence = sequence;
+
+    return 1;
+}
+
+// Wake the media thread from any thread, or note that it should not wait
+// if it is not waiting yet
+void sosg_source_wake(sosg_wake_p wake)
+{
+    if (!wake || !wake->lock) return;
+
+    SDL_mutexP(wake->lock);
+    wake->pending = 1;
+    SDL_CondSignal(wake->cond);
+    SDL_mutexV(wake->lock);
+}
@@ -0,0 +1,97 @@
+#ifndef _SOSG_SOURCE_H_
+#define _SOSG_SOURCE_H_
+
+#include "SDL.h"
+#include "sosg_warp.h"
+
+enum sosg_frame_format {
+    SOSG_FRAME_BGRA,    // 32 bit pixels
+    SOSG_FRAME_YUV,     // 8 bit planes packed into one, see sosg_video.c
+    SOSG_FRAME_TEXTURE  // Already on the GPU, no pixels to upload
+};
+
+// A frame as a source hands it over.  The pixels belong to the source and
+// stay valid until the frame is released.  The core only reads them, and
+// never copies them outside of the upload itself.
+typedef struct sosg_frame_struct {
+    int format;
+    int w;              // In texels, so packed YUV is half again the video width
+    int h;
+    int pitch;          // In bytes
+    void *pixels;
+    // For SOSG_FRAME_TEXTURE, a texture the render thread can bind
+    unsigned int texture;
+    Uint32 sequence;    // Increases with every new frame from the source
+} sosg_frame_t, *sosg_frame_p;
+
+typedef struct sosg_source_stats_struct {
+    int decoded;
+    int presented;
+    int dropped;
+    // Milliseconds from switching items to the first frame of the new one
+    int switches;
+    int switch_last;
+    int switch_max;
+    // Frames that went up after they were due, and the most late one in ms
+    int late;
+    int late_max;
+    // For sources that poll a server, full refreshes and the ms they took,
+    // and how many of the requests sent went unanswered
+    int refreshes;
+    int refresh_last;
+    int refresh_max;
+    int requests;
+    int lost;
+} sosg_source_stats_t, *sosg_source_stats_p;
+
+// Sources with threads of their own use this to tell the media thread they
+// have a frame ready, so it doesn't have to keep polling them
+typedef struct sosg_wake_struct {
+    SDL_mutex *lock;
+    SDL_cond *cond;
+    int pending;
+} sosg_wake_t, *sosg_wake_p;
+
+// Everything a source might need from the command line
+typedef struct sosg_source_config_struct {
+    int num_paths;
+    char **paths;
+    int cache_mb;
+    int yuv;
+    int scrub;
+    float fps;          // Time-lapse speed, negative to play backwards
+    int playback;
+    sosg_limits_p limits;
+    sosg_wake_p wake;
+    int synthetic;      // Satellites to make up for a benchmark
+} sosg_source_config_t, *sosg_source_config_p;
+
+// Sources are used through this table, and everything but acquire_frame
+// may be NULL.  init, get_resolution and destroy are called from the main
+// thread while the media thread isn't running, render from the render
+// thread, and get_stats from any thread, so sources lock what it reads.
+// Everything else comes from the media thread.
+typedef struct sosg_source_struct {
+    const char *name;
+    void *(*init)(sosg_source_config_p config);
+    void (*destroy)(void *source);
+    void (*seek)(void *source, int index);
+    // Moves to a position from 0 to 1 through the current item
+    void (*scrub)(void *source, float position);
+    // Returns 1 and fills in the frame if there is a new one
+    int (*acquire_frame)(void *source, sosg_frame_p frame);
+    void (*release_frame)(void *source, sosg_frame_p frame);
+    void (*get_resolution)(void *source, int *resolution);
+    void (*get_stats)(void *source, sosg_source_stats_p stats);
+    // For sources that draw their own SOSG_FRAME_TEXTURE frames on the GPU,
+    // called from the render thread to draw one and set its texture
+    void (*render)(void *source, sosg_frame_p frame);
+    // For sources that step by the clock rather than waking the media
+    // thread, the ms until the next frame is due, or negative if none is
+    int (*due)(void *source);
+} sosg_source_t, *sosg_source_p;
+
+int sosg_frame_from_surface(sosg_frame_p frame, SDL_Surface *surface, Uint32 sequence);
+void sosg_source_wake(sosg_wake_p wake);
+
+#endif /* _SOSG_SOURCE_H_ */
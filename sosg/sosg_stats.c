@@ -0,0 +1,188 @@
+#include "sosg_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Enough history to cover the last half minute or so
+#define STATS_FRAMES 2048
+// Frames averaged for the summary
+#define STATS_WINDOW 60
+
+static const char *stage_names[STATS_NUM_STAGES] = {
+    "events", "decode", "upload", "draw", "swap", "wait", "input", "hud",
+    "gpu"
+};
+
+static const char *counter_names[STATS_NUM_COUNTERS] = {
+    "decoded", "dropped", "uploaded", "bytes"
+};
+
+typedef struct stats_frame_struct {
+    double start;
+    float stages[STATS_NUM_STAGES];
+    Uint64 counters[STATS_NUM_COUNTERS];
+} stats_frame_t, *stats_frame_p;
+
+// Frames are written into a ring by the render thread and published by
+// advancing the count, so a reader can take a consistent snapshot of every
+// frame before it without a lock
+typedef struct sosg_stats_struct {
+    stats_frame_t frames[STATS_FRAMES];
+    int count;
+    stats_frame_t current;
+    double last;
+} sosg_stats_t;
+
+static double get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+sosg_stats_p sosg_stats_init(void)
+{
+    sosg_stats_p stats = calloc(1, sizeof(sosg_stats_t));
+    if (stats) {
+        stats->current.start = get_time();
+        stats->last = stats->current.start;
+    }
+    return stats;
+}
+
+void sosg_stats_destroy(sosg_stats_p stats)
+{
+    if (stats) free(stats);
+}
+
+// Charge the time since the last mark to a stage
+void sosg_stats_mark(sosg_stats_p stats, int stage)
+{
+    if (stats) {
+        double now = get_time();
+        stats->current.stages[stage] += now - stats->last;
+        stats->last = now;
+    }
+}
+
+void sosg_stats_set_stage(sosg_stats_p stats, int stage, float ms)
+{
+    if (stats) stats->current.stages[stage] = ms;
+}
+
+void sosg_stats_add(sosg_stats_p stats, int counter, int count)
+{
+    if (stats) stats->current.counters[counter] += count;
+}
+
+void sosg_stats_set(sosg_stats_p stats, int counter, Uint64 total)
+{
+    if (stats) stats->current.counters[counter] = total;
+}
+
+// Publish the current frame and start timing the next one, carrying the
+// counter totals over
+void sosg_stats_next_frame(sosg_stats_p stats)
+{
+    if (stats) {
+        stats->frames[stats->count % STATS_FRAMES] = stats->current;
+        __atomic_store_n(&stats->count, stats->count + 1, __ATOMIC_RELEASE);
+
+        memset(stats->current.stages, 0, sizeof(stats->current.stages));
+        stats->current.start = get_time();
+        stats->last = stats->current.start;
+    }
+}
+
+// Write averages over the last few frames, one line per group, for the HUD
+void sosg_stats_summary(sosg_stats_p stats, char *text, int size)
+{
+    float stages[STATS_NUM_STAGES] = {0};
+    int i, j, n, len, gpu_frames = 0;
+
+    text[0] = '\0';
+    if (!stats) return;
+
+    int count = __atomic_load_n(&stats->count, __ATOMIC_ACQUIRE);
+    n = count < STATS_WINDOW ? count : STATS_WINDOW;
+    if (n < 2) return;
+
+    for (i = count - n; i < count; i++) {
+        stats_frame_p frame = stats->frames + i % STATS_FRAMES;
+        for (j = 0; j < STATS_NUM_STAGES; j++) stages[j] += frame->stages[j];
+        if (frame->stages[STATS_GPU] > 0.0) gpu_frames++;
+    }
+    // Not every frame gets a GPU time back
+    stages[STATS_GPU] *= gpu_frames ? (float)n/gpu_frames : 0.0;
+
+    stats_frame_p first = stats->frames + (count - n) % STATS_FRAMES;
+    stats_frame_p last = stats->frames + (count - 1) % STATS_FRAMES;
+    double seconds = (last->start - first->start)/1000.0;
+    if (seconds <= 0.0) return;
+
+    len = snprintf(text, size, "%.1f fps\n", (n - 1)/seconds);
+    for (j = 0; j < STATS_NUM_STAGES && len < size; j++) {
+        len += snprintf(text + len, size - len, "%s %.2f ms%s", stage_names[j],
+            stages[j]/n, j % 4 == 3 || j == STATS_NUM_STAGES - 1 ? "\n" : "  ");
+    }
+    for (j = 0; j < STATS_NUM_COUNTERS && len < size; j++) {
+        double rate = (last->counters[j] - first->counters[j])/seconds;
+        if (j == STATS_BYTES) {
+            len += snprintf(text + len, size - len, "%.1f MB/s", rate/(1024.0*1024.0));
+        } else {
+            len += snprintf(text + len, size - len, "%s %.1f/s  ", counter_names[j], rate);
+        }
+    }
+}
+
+// Write every frame still in the ring to a file, as JSON if the name ends in
+// .json and CSV otherwise
+int sosg_stats_dump(sosg_stats_p stats, const char *path)
+{
+    int i, j;
+
+    if (!stats || !path) return -1;
+
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Could not write statistics to %s\n", path);
+        return -1;
+    }
+
+    int count = __atomic_load_n(&stats->count, __ATOMIC_ACQUIRE);
+    int first = count > STATS_FRAMES ? count - STATS_FRAMES : 0;
+    int json = strlen(path) > 5 && !strcmp(path + strlen(path) - 5, ".json");
+
+    if (json) {
+        fprintf(fp, "[\n");
+    } else {
+        fprintf(fp, "start");
+        for (j = 0; j < STATS_NUM_STAGES; j++) fprintf(fp, ",%s", stage_names[j]);
+        for (j = 0; j < STATS_NUM_COUNTERS; j++) fprintf(fp, ",%s", counter_names[j]);
+        fprintf(fp, "\n");
+    }
+
+    for (i = first; i < count; i++) {
+        stats_frame_p frame = stats->frames + i % STATS_FRAMES;
+        if (json) {
+            fprintf(fp, "  {\"start\": %.3f", frame->start);
+            for (j = 0; j < STATS_NUM_STAGES; j++)
+                fprintf(fp, ", \"%s\": %.3f", stage_names[j], frame->stages[j]);
+            for (j = 0; j < STATS_NUM_COUNTERS; j++)
+                fprintf(fp, ", \"%s\": %llu", counter_names[j],
+                    (unsigned long long)frame->counters[j]);
+            fprintf(fp, "}%s\n", i < count - 1 ? "," : "");
+        } else {
+            fprintf(fp, "%.3f", frame->start);
+            for (j = 0; j < STATS_NUM_STAGES; j++) fprintf(fp, ",%.3f", frame->stages[j]);
+            for (j = 0; j < STATS_NUM_COUNTERS; j++)
+                fprintf(fp, ",%llu", (unsigned long long)frame->counters[j]);
+            fprintf(fp, "\n");
+        }
+    }
+
+    if (json) fprintf(fp, "]\n");
+    fclose(fp);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef _SOSG_STATS_H_
+#define _SOSG_STATS_H_
+
+#include "SDL.h"
+
+// Stages of the main loop, in the order they run
+enum sosg_stats_stage {
+    STATS_EVENTS,
+    STATS_DECODE,  // Getting a frame from the source, on the media thread
+    STATS_UPLOAD,
+    STATS_DRAW,
+    STATS_SWAP,
+    STATS_WAIT,
+    STATS_INPUT,
+    STATS_HUD,
+    STATS_GPU,     // Measured by the GPU, so it arrives a few frames late
+    STATS_NUM_STAGES
+};
+
+// Running totals, kept per source
+enum sosg_stats_counter {
+    STATS_DECODED,
+    STATS_DROPPED,
+    STATS_UPLOADED,
+    STATS_BYTES,
+    STATS_NUM_COUNTERS
+};
+
+typedef struct sosg_stats_struct *sosg_stats_p;
+
+sosg_stats_p sosg_stats_init(void);
+void sosg_stats_destroy(sosg_stats_p stats);
+void sosg_stats_mark(sosg_stats_p stats, int stage);
+void sosg_stats_set_stage(sosg_stats_p stats, int stage, float ms);
+void sosg_stats_add(sosg_stats_p stats, int counter, int count);
+void sosg_stats_set(sosg_stats_p stats, int counter, Uint64 total);
+void sosg_stats_next_frame(sosg_stats_p stats);
+void sosg_stats_summary(sosg_stats_p stats, char *text, int size);
+int sosg_stats_dump(sosg_stats_p stats, const char *path);
+
+#endif /* _SOSG_STATS_H_ */
@@ -2,91 +2,611 @@
 
 #include "sosg_video.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vlc/vlc.h>
 
-// TODO: Make the size dynamic based on input resolution
-#define VIDEOWIDTH 2048
-#define VIDEOHEIGHT 1024
+// Frames are triple buffered between VLC and the render loop.  The decoder
+// owns the back frame and the renderer owns the front one.  The ready frame
+// is swapped between them atomically, with a flag marking whether it holds
+// a frame that has not been presented yet.
+#define NUM_FRAMES 3
+#define FRAME_NEW 0x4
+#define MIN_RETIRED (8*NUM_DECKS*NUM_FRAMES)
 
-typedef struct sosg_video_struct {
-    SDL_Surface *buffer;
+// Each deck is a player with its own frames.  One plays while the others
+// hold the next and previous items paused on their first frames, so that
+// switching to either is just a change of which deck the renderer reads.
+#define NUM_DECKS 3
+#define DECK_TIMEOUT 2000
+
+// When scrubbing, decoded frames are kept around the frame the Tracker points
+// at, filled ahead of it in the direction it is turning
+#define SCRUB_CACHE 16
+#define SCRUB_AHEAD 6
+#define SCRUB_TIMEOUT 1000
+#define SCRUB_FPS 30.0
+
+enum deck_state {
+    DECK_READY,  // Playing, paused on a frame, or unused
+    DECK_LOAD,   // Needs its item opened
+    DECK_REWIND  // Needs to go back to the start of its item
+};
+
+typedef struct scrub_frame_struct {
+    int frame;
     SDL_Surface *surface;
-    SDL_mutex *mutex;
-    libvlc_instance_t *libvlc;
-    libvlc_media_list_t *ml;
-    libvlc_media_list_player_t *mlp;
+} scrub_frame_t;
+
+typedef struct video_deck_struct {
+    struct sosg_video_struct *video;
     libvlc_media_player_t *mp;
+    int item;
+    int playing;    // The item the player has open, which lags item
+    int state;
+    SDL_Surface *frames[NUM_FRAMES];
+    SDL_Surface *bands[NUM_FRAMES];
+    int back;
+    int front;
+    int ready;
+    int decoded;
+    int waiting;
+    int w;
+    int h;
+    SDL_Rect band;
+} video_deck_t, *video_deck_p;
+
+typedef struct sosg_video_struct {
+    video_deck_t decks[NUM_DECKS];
+    int current;
+    SDL_Surface **retired;
+    SDL_mutex *retire_lock;
+    int num_retired;
+    int max_retired;
+    int decoded;
+    int presented;
+    int dropped;
+    int switching;
+    Uint32 switch_start;
+    int switches;
+    int switch_last;
+    int switch_max;
+    libvlc_instance_t *libvlc;
+    libvlc_media_t **media;
     int num_videos;
+    int yuv;
+    sosg_limits_t limits;
+    sosg_wake_p ready;
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    SDL_cond *frame;
+    int running;
+    int scrub;
+    int scrub_index;
+    int scrub_opened;
+    int scrub_frames;
+    float scrub_fps;
+    int scrub_target;
+    int scrub_direction;
+    int scrub_position;
+    scrub_frame_t cache[SCRUB_CACHE];
+    int shown;
 } sosg_video_t;
 
+// Allocate the frames VLC decodes into.  RGB frames are 32 bit.  Planar YUV
+// frames are a single 8 bit surface one and a half times as wide as the
+// video: luma on the left, and chroma on the right with rows of U and V
+// interleaved, so any band of rows is contiguous and costs 1.5 bytes a pixel.
+static void alloc_frames(video_deck_p deck, int w, int h)
+{
+    sosg_video_p video = deck->video;
+    int i, rows[2];
+
+    // Frames the renderer may still be using are freed by it on its next update
+    SDL_mutexP(video->retire_lock);
+    for (i = 0; i < NUM_FRAMES; i++) {
+        if (!deck->frames[i]) continue;
+        if (video->num_retired + 2 > video->max_retired) {
+            int grown = video->max_retired ? video->max_retired*2 : MIN_RETIRED;
+            SDL_Surface **more = realloc(video->retired, grown*sizeof(SDL_Surface *));
+            if (more) {
+                video->retired = more;
+                video->max_retired = grown;
+            }
+        }
+        if (video->num_retired + 2 <= video->max_retired) {
+            video->retired[video->num_retired++] = deck->bands[i];
+            video->retired[video->num_retired++] = deck->frames[i];
+        } else {
+            // Out of memory, so free them now rather than leak whole frames
+            fprintf(stderr, "Warning: Freeing video frames that may still be in use\n");
+            SDL_FreeSurface(deck->bands[i]);
+            SDL_FreeSurface(deck->frames[i]);
+        }
+    }
+    SDL_mutexV(video->retire_lock);
+
+    deck->w = w;
+    deck->h = h;
+
+    // Only the latitude band of each frame is handed out for display
+    sosg_warp_band_rows(&video->limits, h, rows);
+    if (video->yuv && (rows[0] & 1)) {
+        // Keep chroma row pairs together
+        rows[0]--;
+        rows[1]++;
+    }
+    deck->band.x = 0;
+    deck->band.y = rows[0];
+    deck->band.w = video->yuv ? w*3/2 : w;
+    deck->band.h = rows[1];
+
+    for (i = 0; i < NUM_FRAMES; i++) {
+        if (video->yuv) {
+            deck->frames[i] = SDL_CreateRGBSurface(SDL_SWSURFACE, w*3/2, h, 8, 0, 0, 0, 0);
+        } else {
+            deck->frames[i] = SDL_CreateRGBSurface(SDL_SWSURFACE, w, h, 32,
+                0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+        }
+        deck->bands[i] = SDL_CreateRGBSurfaceFrom((Uint8 *)deck->frames[i]->pixels
+            + deck->band.y*deck->frames[i]->pitch, deck->band.w, deck->band.h,
+            deck->frames[i]->format->BitsPerPixel, deck->frames[i]->pitch,
+            deck->frames[i]->format->Rmask, deck->frames[i]->format->Gmask,
+            deck->frames[i]->format->Bmask, deck->frames[i]->format->Amask);
+    }
+
+    // Whatever was ready belonged to the old frames
+    __atomic_and_fetch(&deck->ready, ~FRAME_NEW, __ATOMIC_ACQ_REL);
+}
+
 static void *lock(void *data, void **p_pixels)
 {
-    sosg_video_p video = data;
+    video_deck_p deck = data;
+    SDL_Surface *frame = deck->frames[deck->back];
 
-    SDL_LockMutex(video->mutex);
-    SDL_LockSurface(video->buffer);
-    *p_pixels = video->buffer->pixels;
+    // Only the decoder thread ever touches the back frame
+    p_pixels[0] = frame->pixels;
+    if (deck->video->yuv) {
+        // U and V start on alternate rows of the chroma half
+        p_pixels[1] = (Uint8 *)frame->pixels + deck->w;
+        p_pixels[2] = (Uint8 *)frame->pixels + deck->w + frame->pitch;
+    }
     return NULL; /* picture identifier, not needed here */
 }
 
 static void unlock(void *data, void *id, void *const *p_pixels)
 {
-    sosg_video_p video = data;
+    video_deck_p deck = data;
+    sosg_video_p video = deck->video;
+
+    // Publish the finished frame and take whatever was ready as the new back.
+    // Frames from an item the deck has since been given aren't shown.
+    int playing = __atomic_load_n(&deck->playing, __ATOMIC_ACQUIRE);
+    int fresh = playing == __atomic_load_n(&deck->item, __ATOMIC_ACQUIRE);
+    int old = __atomic_exchange_n(&deck->ready, deck->back | (fresh ? FRAME_NEW : 0),
+        __ATOMIC_ACQ_REL);
+    // The deck may have been given a new item while this one was published
+    if (fresh && playing != __atomic_load_n(&deck->item, __ATOMIC_ACQUIRE))
+        __atomic_and_fetch(&deck->ready, ~FRAME_NEW, __ATOMIC_ACQ_REL);
+    deck->back = old & ~FRAME_NEW;
+    __atomic_add_fetch(&video->decoded, 1, __ATOMIC_RELAXED);
+    // If the renderer never picked up the frame we just replaced, it is lost.
+    // Decks that are pre-rolling replace frames nobody is waiting for.
+    int current = deck == video->decks + __atomic_load_n(&video->current, __ATOMIC_RELAXED);
+    if ((old & FRAME_NEW) && current)
+        __atomic_add_fetch(&video->dropped, 1, __ATOMIC_RELAXED);
+    // The media thread only wants frames from the deck on screen
+    if (current) sosg_source_wake(video->ready);
 
-    SDL_UnlockSurface(video->buffer);
-    SDL_UnlockMutex(video->mutex);
+    // Only take the lock when a worker thread is waiting on this deck
+    __atomic_add_fetch(&deck->decoded, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&deck->waiting, __ATOMIC_SEQ_CST)) {
+        SDL_mutexP(video->lock);
+        SDL_CondSignal(video->frame);
+        SDL_mutexV(video->lock);
+    }
 }
 
 static void display(void *data, void *id)
 {
-    
+
+}
+
+static unsigned format(void **data, char *chroma, unsigned *width, unsigned *height,
+    unsigned *pitches, unsigned *lines)
+{
+    video_deck_p deck = *data;
+    int factor[2];
+
+    // VLC calls this whenever the deck opens media with a new size.  Keep
+    // the media's own size, short of what the globe can't show, and even
+    // enough for the chroma planes.
+    sosg_warp_reduction(&deck->video->limits, *width, *height, factor);
+    *width = (*width/factor[0]) & ~3;
+    *height = (*height/factor[1]) & ~1;
+    if (*width == 0 || *height == 0) {
+        fprintf(stderr, "Error: Video is too small to display\n");
+        return 0;
+    }
+    if (deck->w != *width || deck->h != *height || !deck->frames[0]) {
+        alloc_frames(deck, *width, *height);
+    }
+
+    pitches[0] = deck->frames[0]->pitch;
+    lines[0] = *height;
+    if (deck->video->yuv) {
+        // Leave the conversion to RGB to the fragment shader
+        memcpy(chroma, "I420", 4);
+        pitches[1] = pitches[2] = 2*deck->frames[0]->pitch;
+        lines[1] = lines[2] = *height/2;
+    } else {
+        memcpy(chroma, "RV32", 4);
+    }
+
+    // A single picture keeps VLC from locking more than one frame at a time
+    return 1;
+}
+
+static void cleanup(void *data)
+{
+
+}
+
+// Take the newest frame from a deck's triple buffer.  Only one thread may do
+// this, the renderer normally, or the scrub thread when scrubbing.
+static SDL_Surface *take_frame(sosg_video_p video, video_deck_p deck)
+{
+    // The last frame we took is done with, so old frames can go
+    if (__atomic_load_n(&video->num_retired, __ATOMIC_ACQUIRE)) {
+        SDL_mutexP(video->retire_lock);
+        while (video->num_retired) SDL_FreeSurface(video->retired[--video->num_retired]);
+        SDL_mutexV(video->retire_lock);
+    }
+
+    // Nothing new unless VLC finished a frame since the last time
+    if (!(__atomic_load_n(&deck->ready, __ATOMIC_ACQUIRE) & FRAME_NEW)) return NULL;
+
+    // Swap the new frame to the front without copying it
+    int old = __atomic_exchange_n(&deck->ready, deck->front, __ATOMIC_ACQ_REL);
+    deck->front = old & ~FRAME_NEW;
+
+    return deck->bands[deck->front];
+}
+
+// Wait for a deck to finish a frame past the given count, with the lock held
+static int frame_wait(sosg_video_p video, video_deck_p deck, int decoded, int timeout)
+{
+    int result = 0;
+
+    __atomic_store_n(&deck->waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&deck->decoded, __ATOMIC_SEQ_CST) == decoded) {
+        if (SDL_CondWaitTimeout(video->frame, video->lock, timeout) == SDL_MUTEX_TIMEDOUT) {
+            result = -1;
+            break;
+        }
+    }
+    __atomic_store_n(&deck->waiting, 0, __ATOMIC_SEQ_CST);
+
+    return result;
+}
+
+static int deck_holds(sosg_video_p video, int item)
+{
+    int i;
+    for (i = 0; i < NUM_DECKS; i++) {
+        if (video->decks[i].item == item) return 1;
+    }
+    return 0;
+}
+
+// Have the load thread open an item on a deck.  Any frame still waiting
+// there is from its old item, so it must not be shown as this one's.
+static void deck_open(video_deck_p deck, int item)
+{
+    __atomic_store_n(&deck->item, item, __ATOMIC_RELEASE);
+    deck->state = DECK_LOAD;
+    __atomic_and_fetch(&deck->ready, ~FRAME_NEW, __ATOMIC_ACQ_REL);
+}
+
+// Point the decks that aren't playing at the items on either side of the one
+// that is, reusing any deck that already holds one of them
+static void assign_decks(sosg_video_p video)
+{
+    int wanted[2], i, j;
+    int item = video->decks[video->current].item;
+
+    if (video->scrub || video->num_videos < 2 || item < 0) return;
+
+    wanted[0] = (item + 1)%video->num_videos;
+    wanted[1] = (item + video->num_videos - 1)%video->num_videos;
+
+    for (i = 0; i < 2; i++) {
+        if (deck_holds(video, wanted[i])) continue;
+        for (j = 0; j < NUM_DECKS; j++) {
+            video_deck_p deck = video->decks + j;
+            if (j == video->current || deck->item == wanted[0] ||
+                deck->item == wanted[1])
+                continue;
+            deck_open(deck, wanted[i]);
+            break;
+        }
+    }
+}
+
+// Open and pre-roll decks off the render thread, since libVLC blocks while a
+// player stops whatever it had open
+static int deck_load(void *data)
+{
+    sosg_video_p video = data;
+    int i;
+
+    SDL_mutexP(video->lock);
+    while (video->running) {
+        video_deck_p deck = NULL;
+        for (i = 0; i < NUM_DECKS; i++) {
+            if (video->decks[i].state != DECK_READY) {
+                deck = video->decks + i;
+                break;
+            }
+        }
+        if (!deck) {
+            SDL_CondWait(video->wake, video->lock);
+            continue;
+        }
+
+        int state = deck->state;
+        int item = deck->item;
+        int decoded = __atomic_load_n(&deck->decoded, __ATOMIC_SEQ_CST);
+        deck->state = DECK_READY;
+        SDL_mutexV(video->lock);
+
+        if (state == DECK_LOAD) {
+            libvlc_media_player_set_media(deck->mp, video->media[item]);
+            // The old item is stopped now, so drop any frame it left and
+            // only count frames from this one
+            __atomic_store_n(&deck->playing, item, __ATOMIC_RELEASE);
+            __atomic_and_fetch(&deck->ready, ~FRAME_NEW, __ATOMIC_ACQ_REL);
+            decoded = __atomic_load_n(&deck->decoded, __ATOMIC_SEQ_CST);
+            libvlc_media_player_play(deck->mp);
+        } else {
+            libvlc_media_player_set_time(deck->mp, 0);
+            libvlc_media_player_set_pause(deck->mp, 0);
+        }
+
+        SDL_mutexP(video->lock);
+        if (frame_wait(video, deck, decoded, DECK_TIMEOUT))
+            fprintf(stderr, "Warning: Timed out pre-rolling video %d\n", item);
+        // Hold it on its first frame, unless it was switched to meanwhile.
+        // This happens under the lock so it can't undo a switch.
+        if (deck != video->decks + video->current && deck->state == DECK_READY)
+            libvlc_media_player_set_pause(deck->mp, 1);
+    }
+    SDL_mutexV(video->lock);
+
+    return 0;
+}
+
+static int scrub_find(sosg_video_p video, int frame)
+{
+    int i;
+    for (i = 0; i < SCRUB_CACHE; i++) {
+        if (video->cache[i].frame == frame) return i;
+    }
+    return -1;
+}
+
+// Find the next frame worth decoding.  That is the target itself, and then
+// the frames ahead of it.  Going backwards, the earliest missing frame comes
+// first, so that a single seek can decode forward through the rest.
+static int scrub_missing(sosg_video_p video)
+{
+    int i, frame, missing = -1;
+
+    if (scrub_find(video, video->scrub_target) < 0) return video->scrub_target;
+
+    for (i = 1; i <= SCRUB_AHEAD; i++) {
+        frame = video->scrub_target + i*video->scrub_direction;
+        if (frame < 0 || frame >= video->scrub_frames) break;
+        if (scrub_find(video, frame) < 0) {
+            missing = frame;
+            if (video->scrub_direction > 0) break;
+        }
+    }
+
+    return missing;
 }
 
-sosg_video_p sosg_video_init(int num_paths, char *paths[])
+// Pick a cache slot for a new frame, evicting the one farthest from the
+// target, but never the one the renderer has
+static int scrub_slot(sosg_video_p video)
 {
+    int i, slot = -1, distance = -1;
+
+    for (i = 0; i < SCRUB_CACHE; i++) {
+        if (i == video->shown) continue;
+        if (video->cache[i].frame < 0) return i;
+        int d = abs(video->cache[i].frame - video->scrub_target);
+        if (d > distance) {
+            slot = i;
+            distance = d;
+        }
+    }
+
+    return slot;
+}
+
+// Start the item being scrubbed and pause it on its first frame.  Called with
+// the lock held, which is dropped around VLC calls since they may wait on the
+// decoder, which may be waiting in unlock().
+static void scrub_open(sosg_video_p video)
+{
+    video_deck_p deck = video->decks;
+    int index = video->scrub_index;
+    int decoded = __atomic_load_n(&deck->decoded, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&deck->item, index, __ATOMIC_RELEASE);
+    video->scrub_opened = 1;
+    video->scrub_position = -1;
+    SDL_mutexV(video->lock);
+
+    libvlc_media_player_set_media(deck->mp, video->media[index]);
+    __atomic_store_n(&deck->playing, index, __ATOMIC_RELEASE);
+    libvlc_media_player_play(deck->mp);
+
+    SDL_mutexP(video->lock);
+    if (frame_wait(video, deck, decoded, DECK_TIMEOUT))
+        fprintf(stderr, "Warning: Timed out opening video %d to scrub\n", index);
+    SDL_mutexV(video->lock);
+
+    libvlc_media_player_set_pause(deck->mp, 1);
+    float fps = libvlc_media_player_get_fps(deck->mp);
+    libvlc_time_t length = libvlc_media_player_get_length(deck->mp);
+
+    SDL_mutexP(video->lock);
+    video->scrub_fps = fps > 0.0 ? fps : SCRUB_FPS;
+    video->scrub_frames = length*video->scrub_fps/1000.0;
+    if (video->scrub_frames < 1) video->scrub_frames = 1;
+    if (video->scrub_target >= video->scrub_frames)
+        video->scrub_target = video->scrub_frames - 1;
+}
+
+// Decode the frames around the scrub target.  libVLC has no way to decode a
+// given frame directly, but with the player paused, seeking decodes forward
+// from the preceding keyframe to the new time, and stepping decodes just the
+// next frame, so sequential frames only cost a seek for the first.
+static int scrub_decode(void *data)
+{
+    sosg_video_p video = data;
+    video_deck_p deck = video->decks;
+    int i;
+
+    SDL_mutexP(video->lock);
+    while (video->running) {
+        if (!video->scrub_opened) {
+            scrub_open(video);
+            continue;
+        }
+
+        int frame = scrub_missing(video);
+        if (frame < 0) {
+            // Everything around the target is cached
+            SDL_CondWait(video->wake, video->lock);
+            continue;
+        }
+
+        int decoded = __atomic_load_n(&deck->decoded, __ATOMIC_SEQ_CST);
+        int step = frame == video->scrub_position + 1;
+        libvlc_time_t time = frame*1000.0/video->scrub_fps;
+        SDL_mutexV(video->lock);
+
+        if (step) libvlc_media_player_next_frame(deck->mp);
+        else libvlc_media_player_set_time(deck->mp, time);
+
+        SDL_mutexP(video->lock);
+        if (frame_wait(video, deck, decoded, SCRUB_TIMEOUT)) {
+            video->scrub_position = -1;
+            continue;
+        }
+        // The item may have changed while VLC was decoding
+        if (!video->scrub_opened) continue;
+
+        SDL_Surface *band = take_frame(video, deck);
+        int slot = scrub_slot(video);
+        if (!band || slot < 0) continue;
+        scrub_frame_t *cached = video->cache + slot;
+        cached->frame = -1;
+        SDL_mutexV(video->lock);
+
+        // Copy it out, since the decoder will reuse its frame for the next one
+        if (cached->surface && (cached->surface->w != band->w ||
+                cached->surface->h != band->h ||
+                cached->surface->format->BitsPerPixel != band->format->BitsPerPixel)) {
+            SDL_FreeSurface(cached->surface);
+            cached->surface = NULL;
+        }
+        if (!cached->surface) {
+            cached->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, band->w, band->h,
+                band->format->BitsPerPixel, band->format->Rmask,
+                band->format->Gmask, band->format->Bmask, band->format->Amask);
+        }
+        if (cached->surface) {
+            for (i = 0; i < band->h; i++) {
+                memcpy((Uint8 *)cached->surface->pixels + i*cached->surface->pitch,
+                    (Uint8 *)band->pixels + i*band->pitch,
+                    band->w*band->format->BytesPerPixel);
+            }
+        }
+
+        SDL_mutexP(video->lock);
+        video->scrub_position = frame;
+        if (cached->surface && video->scrub_opened) {
+            cached->frame = frame;
+            sosg_source_wake(video->ready);
+        }
+    }
+    SDL_mutexV(video->lock);
+
+    return 0;
+}
+
+sosg_video_p sosg_video_init(int num_paths, char *paths[], sosg_limits_p limits,
+    int yuv, int scrub, sosg_wake_p wake)
+{
+    int i;
     sosg_video_p video = calloc(1, sizeof(sosg_video_t));
     if (video) {
-        video->mutex = SDL_CreateMutex();
-            
-        video->buffer = SDL_CreateRGBSurface(SDL_SWSURFACE, VIDEOWIDTH, VIDEOHEIGHT, 32, 
-            0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-        video->surface = SDL_CreateRGBSurface(SDL_SWSURFACE, VIDEOWIDTH, VIDEOHEIGHT, 32, 
-            0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-        
+        video->yuv = yuv;
+        video->scrub = scrub;
+        video->retire_lock = SDL_CreateMutex();
+        video->lock = SDL_CreateMutex();
+        video->wake = SDL_CreateCond();
+        video->frame = SDL_CreateCond();
+        if (limits) video->limits = *limits;
+        video->ready = wake;
+
         char const *vlc_argv[] =
         {
             "--input-repeat=-1",
             //"--no-video-title-show",
             "--no-audio", /* skip any audio track */
             "--no-xlib", /* tell VLC to not use Xlib */
-        };        
+        };
         int vlc_argc = sizeof(vlc_argv) / sizeof(*vlc_argv);
-        
+
         video->libvlc = libvlc_new(vlc_argc, vlc_argv);
-        video->mlp = libvlc_media_list_player_new(video->libvlc);
-        video->mp = libvlc_media_player_new(video->libvlc);
-        video->ml = libvlc_media_list_new(video->libvlc);
-        
-        libvlc_media_list_player_set_media_player(video->mlp, video->mp);
-        libvlc_media_list_player_set_media_list(video->mlp, video->ml);
-        
-        int i;
+        video->media = calloc(num_paths, sizeof(libvlc_media_t *));
+
         for (i = 0; i < num_paths; i++) {
             libvlc_media_t *m = libvlc_media_new_path(video->libvlc, paths[i]);
-            if (m) {
-                video->num_videos++;
-                libvlc_media_list_add_media(video->ml, m);
-                libvlc_media_release(m);
-            }
+            if (m) video->media[video->num_videos++] = m;
+        }
+
+        for (i = 0; i < NUM_DECKS; i++) {
+            video_deck_p deck = video->decks + i;
+            deck->video = video;
+            deck->item = -1;
+            deck->playing = -1;
+            deck->front = 0;
+            deck->ready = 1;
+            deck->back = 2;
+            deck->mp = libvlc_media_player_new(video->libvlc);
+            // Frames are sized by format() as each item is opened
+            libvlc_video_set_callbacks(deck->mp, lock, unlock, display, deck);
+            libvlc_video_set_format_callbacks(deck->mp, format, cleanup);
+        }
+
+        video->running = 1;
+        if (video->scrub) {
+            // The scrub thread opens the first item and holds it paused
+            for (i = 0; i < SCRUB_CACHE; i++) video->cache[i].frame = -1;
+            video->shown = -1;
+            video->scrub_direction = 1;
+            video->thread = SDL_CreateThread(scrub_decode, video);
+        } else if (video->num_videos) {
+            deck_open(video->decks, 0);
+            assign_decks(video);
+            video->thread = SDL_CreateThread(deck_load, video);
         }
-        
-        libvlc_playback_mode_t mode = libvlc_playback_mode_loop;
-        libvlc_media_list_player_set_playback_mode(video->mlp, mode);
-        
-        libvlc_video_set_callbacks(video->mp, lock, unlock, display, video);
-        libvlc_video_set_format(video->mp, "RV32", VIDEOWIDTH, VIDEOHEIGHT, VIDEOWIDTH*4);
-        
-        libvlc_media_list_player_play(video->mlp);
     }
 
     return video;
@@ -94,40 +614,225 @@ sosg_video_p sosg_video_init(int num_paths, char *paths[])
 
 void sosg_video_destroy(sosg_video_p video)
 {
+    int i, j;
     if (video) {
-        if (video->mp) {
-            libvlc_media_player_stop(video->mp);
-            libvlc_media_player_release(video->mp);
+        if (video->thread) {
+            SDL_mutexP(video->lock);
+            video->running = 0;
+            SDL_CondSignal(video->wake);
+            SDL_mutexV(video->lock);
+            SDL_WaitThread(video->thread, NULL);
+        }
+        for (i = 0; i < NUM_DECKS; i++) {
+            video_deck_p deck = video->decks + i;
+            if (deck->mp) {
+                libvlc_media_player_stop(deck->mp);
+                libvlc_media_player_release(deck->mp);
+            }
+            for (j = 0; j < NUM_FRAMES; j++) {
+                if (deck->bands[j]) SDL_FreeSurface(deck->bands[j]);
+                if (deck->frames[j]) SDL_FreeSurface(deck->frames[j]);
+            }
+        }
+        for (i = 0; i < video->num_videos; i++) {
+            libvlc_media_release(video->media[i]);
         }
-        if (video->ml) libvlc_media_list_release(video->ml);
-        if (video->mlp) libvlc_media_list_player_release(video->mlp);
+        free(video->media);
         if (video->libvlc) libvlc_release(video->libvlc);
-        if (video->buffer) SDL_FreeSurface(video->buffer);
-        if (video->mutex) SDL_DestroyMutex(video->mutex);
+        for (i = 0; i < video->num_retired; i++) {
+            SDL_FreeSurface(video->retired[i]);
+        }
+        free(video->retired);
+        for (i = 0; i < SCRUB_CACHE; i++) {
+            if (video->cache[i].surface) SDL_FreeSurface(video->cache[i].surface);
+        }
+        if (video->retire_lock) SDL_DestroyMutex(video->retire_lock);
+        if (video->wake) SDL_DestroyCond(video->wake);
+        if (video->frame) SDL_DestroyCond(video->frame);
+        if (video->lock) SDL_DestroyMutex(video->lock);
         free(video);
     }
 }
 
 void sosg_video_get_resolution(sosg_video_p video, int *resolution)
 {
-    if (resolution) {
-        resolution[0] = VIDEOWIDTH;
-        resolution[1] = VIDEOHEIGHT;
+    if (resolution && video && video->decks[video->current].w) {
+        resolution[0] = video->decks[video->current].band.w;
+        resolution[1] = video->decks[video->current].band.h;
     }
 }
 
 void sosg_video_set_index(sosg_video_p video, int index)
 {
-    if (video) {
-        libvlc_media_list_player_play_item_at_index(video->mlp, index%video->num_videos);
+    int i, next = -1;
+    if (video && video->num_videos) {
+        index %= video->num_videos;
+        if (index < 0) index += video->num_videos;
+        SDL_mutexP(video->lock);
+        if (video->scrub) {
+            // Have the scrub thread switch items, and forget the old frames
+            if (index != video->scrub_index) {
+                video->scrub_index = index;
+                video->scrub_opened = 0;
+                for (i = 0; i < SCRUB_CACHE; i++) video->cache[i].frame = -1;
+                SDL_CondSignal(video->wake);
+            }
+        } else if (index != video->decks[video->current].item) {
+            for (i = 0; i < NUM_DECKS; i++) {
+                if (i != video->current && video->decks[i].item == index) next = i;
+            }
+            if (next < 0) {
+                // Nothing pre-rolled it, so open it cold on another deck
+                next = (video->current + 1)%NUM_DECKS;
+                deck_open(video->decks + next, index);
+            }
+
+            // The switch itself is just this, the rest happens on the thread.
+            // A deck still waiting to load will be started by the thread, and
+            // is left to load rather than rewind media it hasn't opened.
+            if (video->decks[video->current].state == DECK_READY)
+                video->decks[video->current].state = DECK_REWIND;
+            __atomic_store_n(&video->current, next, __ATOMIC_RELEASE);
+            if (video->decks[next].state == DECK_READY)
+                libvlc_media_player_set_pause(video->decks[next].mp, 0);
+            // The renderer reads these without the lock
+            __atomic_store_n(&video->switch_start, SDL_GetTicks(), __ATOMIC_RELAXED);
+            __atomic_store_n(&video->switching, 1, __ATOMIC_RELEASE);
+
+            assign_decks(video);
+            SDL_CondSignal(video->wake);
+        }
+        SDL_mutexV(video->lock);
+    }
+}
+
+void sosg_video_scrub(sosg_video_p video, float position)
+{
+    if (!video || !video->scrub) return;
+
+    SDL_mutexP(video->lock);
+    int frames = video->scrub_frames ? video->scrub_frames : 1;
+    int target = position*frames;
+    if (target < 0) target = 0;
+    if (target >= frames) target = frames - 1;
+    if (target != video->scrub_target) {
+        int delta = target - video->scrub_target;
+        // Wrapping past the end of the movie still counts as going forward
+        if (abs(delta) > frames/2) delta = -delta;
+        video->scrub_direction = delta > 0 ? 1 : -1;
+        video->scrub_target = target;
+        SDL_CondSignal(video->wake);
     }
+    SDL_mutexV(video->lock);
 }
 
 SDL_Surface *sosg_video_update(sosg_video_p video)
 {
-    SDL_LockMutex(video->mutex);
-    SDL_BlitSurface(video->buffer, NULL, video->surface, NULL);
-    SDL_UnlockMutex(video->mutex);
+    SDL_Surface *surface = NULL;
+    int i, best = -1, distance = 0;
+
+    if (!video) return NULL;
+
+    if (!video->scrub) {
+        surface = take_frame(video, video->decks + video->current);
+        if (surface) {
+            // The statistics may be read from any thread
+            __atomic_add_fetch(&video->presented, 1, __ATOMIC_RELAXED);
+            if (__atomic_exchange_n(&video->switching, 0, __ATOMIC_ACQ_REL)) {
+                // Time from the switch until the new item's frame is up
+                int last = SDL_GetTicks() -
+                    __atomic_load_n(&video->switch_start, __ATOMIC_RELAXED);
+                __atomic_store_n(&video->switch_last, last, __ATOMIC_RELAXED);
+                if (last > video->switch_max)
+                    __atomic_store_n(&video->switch_max, last, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&video->switches, 1, __ATOMIC_RELAXED);
+            }
+        }
+        return surface;
+    }
+
+    // Show the target frame, or the closest one until it is decoded
+    SDL_mutexP(video->lock);
+    for (i = 0; i < SCRUB_CACHE; i++) {
+        if (video->cache[i].frame < 0) continue;
+        int d = abs(video->cache[i].frame - video->scrub_target);
+        if (best < 0 || d < distance) {
+            best = i;
+            distance = d;
+        }
+    }
+    if (best >= 0 && best != video->shown) {
+        video->shown = best;
+        surface = video->cache[best].surface;
+        __atomic_add_fetch(&video->presented, 1, __ATOMIC_RELAXED);
+    }
+    SDL_mutexV(video->lock);
+
+    return surface;
+}
+
+void sosg_video_get_stats(sosg_video_p video, sosg_source_stats_p stats)
+{
+    if (video && stats) {
+        stats->decoded = __atomic_load_n(&video->decoded, __ATOMIC_RELAXED);
+        stats->presented = __atomic_load_n(&video->presented, __ATOMIC_RELAXED);
+        stats->dropped = __atomic_load_n(&video->dropped, __ATOMIC_RELAXED);
+        stats->switches = __atomic_load_n(&video->switches, __ATOMIC_RELAXED);
+        stats->switch_last = __atomic_load_n(&video->switch_last, __ATOMIC_RELAXED);
+        stats->switch_max = __atomic_load_n(&video->switch_max, __ATOMIC_RELAXED);
+    }
+}
+
+static void *video_init(sosg_source_config_p config)
+{
+    return sosg_video_init(config->num_paths, config->paths, config->limits,
+        config->yuv, config->scrub, config->wake);
+}
+
+static void video_destroy(void *source)
+{
+    sosg_video_destroy(source);
+}
+
+static void video_seek(void *source, int index)
+{
+    sosg_video_set_index(source, index);
+}
+
+static void video_scrub(void *source, float position)
+{
+    sosg_video_scrub(source, position);
+}
+
+static int video_acquire_frame(void *source, sosg_frame_p frame)
+{
+    sosg_video_p video = source;
+    // Decks keep the front buffer until the next frame is taken, and scrub
+    // frames stay in the cache until a newer one is shown
+    SDL_Surface *surface = sosg_video_update(video);
+    return sosg_frame_from_surface(frame, surface, surface ? video->presented : 0);
+}
+
+static void video_get_resolution(void *source, int *resolution)
+{
+    sosg_video_get_resolution(source, resolution);
+}
 
-    return video->surface;
+static void video_get_stats(void *source, sosg_source_stats_p stats)
+{
+    sosg_video_get_stats(source, stats);
 }
+
+sosg_source_t sosg_video_source = {
+    "Video",
+    video_init,
+    video_destroy,
+    video_seek,
+    video_scrub,
+    video_acquire_frame,
+    NULL,
+    video_get_resolution,
+    video_get_stats,
+    NULL,
+    NULL
+};
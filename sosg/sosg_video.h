@@ -3,13 +3,21 @@
 
 #include "SDL.h"
 #include "SDL_image.h"
+#include "sosg_warp.h"
+#include "sosg_source.h"
 
 typedef struct sosg_video_struct *sosg_video_p;
 
-sosg_video_p sosg_video_init(int num_paths, char *paths[]);
+extern sosg_source_t sosg_video_source;
+
+sosg_video_p sosg_video_init(int num_paths, char *paths[], sosg_limits_p limits,
+    int yuv, int scrub, sosg_wake_p wake);
 void sosg_video_destroy(sosg_video_p video);
 void sosg_video_get_resolution(sosg_video_p video, int *resolution);
 void sosg_video_set_index(sosg_video_p video, int index);
+// Show the frame at a position from 0 to 1 through the current video
+void sosg_video_scrub(sosg_video_p video, float position);
 SDL_Surface *sosg_video_update(sosg_video_p video);
+void sosg_video_get_stats(sosg_video_p video, sosg_source_stats_p stats);
 
 #endif /* _SOSG_VIDEO_H_ */
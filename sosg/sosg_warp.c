@@ -0,0 +1,117 @@
+#include "sosg_warp.h"
+#include <stdio.h>
+#include <math.h>
+
+#define SIN_PI_4 0.7071067811865475
+// Extra v past the rim to cover the shader's filter taps
+#define BAND_MARGIN 0.005
+
+// Map an offset in pixels from the center of the fisheye to unrotated
+// equirectangular texture coordinates.  This is the same math sosg.frag does
+// per fragment in analytic mode, so keep the two in sync.
+int sosg_warp_map(float radius, float height, float dx, float dy, float *uv)
+{
+    float d = sqrt(dx*dx + dy*dy);
+    if (d > radius) return -1;
+
+    float h = d*SIN_PI_4/radius;
+    float hh = h*height/radius;
+    // Guard against calibrations that would make the shader produce NaNs
+    if (hh > 1.0) hh = 1.0;
+    float theta = asin(hh) + asin(h);
+    float phi = atan2(dx, dy);
+
+    uv[0] = -phi/(2.0*M_PI);
+    uv[1] = theta/M_PI_2;
+
+    return 0;
+}
+
+// Bake the screen space warp into a w by h RGBA16 buffer.  Red holds u
+// wrapped to [0, 1), green holds v/2 so the full [0, 2) range fits, and alpha
+// masks out everything outside of the fisheye.  The rotation is added to u in
+// the shader, so the table only needs to be regenerated on recalibration.
+Uint16 *sosg_warp_lut(int w, int h, float radius, float height, float *center)
+{
+    int x, y;
+    float uv[2];
+    Uint16 *lut = calloc(w*h*4, sizeof(Uint16));
+    if (!lut) {
+        fprintf(stderr, "Error: Could not allocate warp lookup table\n");
+        return NULL;
+    }
+
+    for (y = 0; y < h; y++) {
+        Uint16 *texel = lut + y*w*4;
+        for (x = 0; x < w; x++, texel += 4) {
+            // Sample at the pixel center, like the fragment shader does
+            if (sosg_warp_map(radius, height, x + 0.5 - center[0],
+                    y + 0.5 - center[1], uv))
+                continue;
+
+            uv[0] -= floor(uv[0]);
+            uv[1] *= 0.5;
+            if (uv[1] > 1.0) uv[1] = 1.0;
+            texel[0] = (Uint16)(uv[0]*65535.0 + 0.5);
+            texel[1] = (Uint16)(uv[1]*65535.0 + 0.5);
+            texel[3] = 65535;
+        }
+    }
+
+    return lut;
+}
+
+// Find the texture resolution past which extra texels are never displayed.
+// Horizontally that is the circumference at the rim of the fisheye.
+// Vertically it is the most screen pixels covering a unit of v anywhere
+// along the radius, found by stepping outwards one pixel at a time.  The
+// band is the range of v that is sampled at all, from the pole at the center
+// out to the rim.
+void sosg_warp_limits(float radius, float height, sosg_limits_p limits)
+{
+    float uv[2];
+    float last = 0.0;
+    float density = 0.0;
+    int d;
+
+    for (d = 1; d <= (int)radius; d++) {
+        if (sosg_warp_map(radius, height, d, 0.0, uv)) break;
+        if (uv[1] > last && 1.0/(uv[1] - last) > density)
+            density = 1.0/(uv[1] - last);
+        last = uv[1];
+    }
+
+    limits->resolution[0] = (int)ceil(2.0*M_PI*radius);
+    limits->resolution[1] = (int)ceil(density);
+    limits->band[0] = 0.0;
+    limits->band[1] = last + BAND_MARGIN > 1.0 ? 1.0 : last + BAND_MARGIN;
+}
+
+// Pick the largest power of two reduction on each axis that keeps a w by h
+// source at or above the limits.  Axes are reduced independently, since the
+// fisheye needs far fewer rows than columns.
+void sosg_warp_reduction(sosg_limits_p limits, int w, int h, int *factor)
+{
+    int size[2] = {w, h};
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        factor[i] = 1;
+        if (!limits || limits->resolution[i] <= 0) continue;
+        while (size[i]/(factor[i]*2) >= limits->resolution[i]) factor[i] *= 2;
+    }
+}
+
+// Find the first row and number of rows of an h row source that fall inside
+// the band.  Sources store only these rows, and the shader maps v to match.
+void sosg_warp_band_rows(sosg_limits_p limits, int h, int *rows)
+{
+    rows[0] = 0;
+    rows[1] = h;
+    if (!limits || limits->band[1] <= limits->band[0]) return;
+
+    rows[0] = (int)floor(limits->band[0]*h);
+    rows[1] = (int)ceil(limits->band[1]*h) - rows[0];
+    if (rows[0] + rows[1] > h) rows[1] = h - rows[0];
+    if (rows[1] < 1) rows[1] = 1;
+}
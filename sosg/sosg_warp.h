@@ -0,0 +1,19 @@
+#ifndef _SOSG_WARP_H_
+#define _SOSG_WARP_H_
+
+#include "SDL.h"
+
+// What the warp can actually show, which sources use to avoid decoding,
+// storing and uploading texels that never make it onto the globe
+typedef struct sosg_limits_struct {
+    int resolution[2];
+    float band[2];
+} sosg_limits_t, *sosg_limits_p;
+
+int sosg_warp_map(float radius, float height, float dx, float dy, float *uv);
+Uint16 *sosg_warp_lut(int w, int h, float radius, float height, float *center);
+void sosg_warp_limits(float radius, float height, sosg_limits_p limits);
+void sosg_warp_reduction(sosg_limits_p limits, int w, int h, int *factor);
+void sosg_warp_band_rows(sosg_limits_p limits, int h, int *rows);
+
+#endif /* _SOSG_WARP_H_ */